@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "driver/uart.h"
+#include "esp_attr.h"
+#include "esp_clk.h"
+#include "esp_timer.h"
+
+#include "softserial.h"
+
+// Pins (see README.md for the wiring)
+#define BENCH_TX_PIN GPIO_NUM_4
+#define BENCH_RX_PIN GPIO_NUM_5
+#define BENCH_PROBE_PIN GPIO_NUM_12
+
+// Use hardware UART1 (TX on GPIO2) instead of softserial TX as reference sender
+#define BENCH_UART_REF 0
+
+// Largest payload, the buffers are sized accordingly (power of 2)
+#define BENCH_MAX_PAYLOAD 256
+#define BENCH_BUF_SIZE (2 * BENCH_MAX_PAYLOAD)
+
+// Number of edges, captured for the jitter measurement
+#define BENCH_MAX_EDGES 200
+
+typedef struct {
+    const char* name;
+    uint16_t tx_features;
+    uint16_t rx_features;
+} bench_engine_t;
+
+static const bench_engine_t engines[] = {
+    { "timer TX / timer RX",    SOFTSERIAL_USE_TX | SOFTSERIAL_USE_TIMER, SOFTSERIAL_USE_RX | SOFTSERIAL_USE_TIMER },
+    { "timer TX / edges RX",    SOFTSERIAL_USE_TX | SOFTSERIAL_USE_TIMER, SOFTSERIAL_USE_RX | SOFTSERIAL_USE_EDGES },
+    { "timer TX / resync RX",   SOFTSERIAL_USE_TX | SOFTSERIAL_USE_TIMER,
+        SOFTSERIAL_USE_RX | SOFTSERIAL_USE_TIMER | SOFTSERIAL_USE_RESYNC },
+    { "timer TX / blocking RX", SOFTSERIAL_USE_TX | SOFTSERIAL_USE_TIMER, SOFTSERIAL_USE_RX },
+    { "blocking TX / edges RX", SOFTSERIAL_USE_TX, SOFTSERIAL_USE_RX | SOFTSERIAL_USE_EDGES },
+};
+
+static const uint32_t baudrates[] = { 2400, 9600, 19200, 38400, 57600, 115200 };
+
+static const size_t payloads[] = { 1, 16, 64, BENCH_MAX_PAYLOAD };
+
+static uint8_t tx_buf[BENCH_BUF_SIZE];
+static uint8_t rx_buf[BENCH_BUF_SIZE];
+static uint8_t sent[BENCH_MAX_PAYLOAD];
+static uint8_t received[BENCH_MAX_PAYLOAD];
+
+static softserial tx_unit;
+static softserial rx_unit;
+
+static volatile uint32_t edges[BENCH_MAX_EDGES];
+static volatile unsigned num_edges;
+
+/**
+ * Simple xorshift PRNG for reproducible payloads.
+ */
+static uint32_t prng(void)
+{
+    static uint32_t state = 0x12345678;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static inline uint32_t IRAM_ATTR ccount(void)
+{
+    uint32_t r;
+    __asm__ __volatile__("rsr %0, ccount" : "=r"(r));
+    return r;
+}
+
+static esp_err_t setup_units(const bench_engine_t* e, uint32_t baudrate)
+{
+    esp_err_t ret;
+
+    memset(&rx_unit, 0, sizeof(rx_unit));
+    rx_unit.features = e->rx_features;
+    rx_unit.baudrate = baudrate;
+    rx_unit.rx_pin = BENCH_RX_PIN;
+    rx_unit.tx_pin = GPIO_NUM_13;
+    rx_unit.rx_buffer = rx_buf;
+    rx_unit.rx_buffer_size = sizeof(rx_buf);
+    ret = softserial_init(&rx_unit);
+    if (ESP_OK != ret) {
+        return ret;
+    }
+#if !BENCH_UART_REF
+    memset(&tx_unit, 0, sizeof(tx_unit));
+    tx_unit.features = e->tx_features;
+    tx_unit.baudrate = baudrate;
+    tx_unit.rx_pin = GPIO_NUM_14;
+    tx_unit.tx_pin = BENCH_TX_PIN;
+    tx_unit.tx_buffer = tx_buf;
+    tx_unit.tx_buffer_size = sizeof(tx_buf);
+    ret = softserial_init(&tx_unit);
+    if (ESP_OK != ret) {
+        softserial_deinit(&rx_unit);
+        return ret;
+    }
+#else
+    uart_config_t cfg = {
+        .baud_rate = baudrate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
+    uart_param_config(UART_NUM_1, &cfg);
+#endif
+    return ESP_OK;
+}
+
+static void teardown_units(void)
+{
+#if !BENCH_UART_REF
+    softserial_deinit(&tx_unit);
+#endif
+    softserial_deinit(&rx_unit);
+}
+
+/**
+ * Send the payload.
+ * @return CPU cycles spent sending in the calling task (blocking TX only)
+ */
+static uint32_t bench_send(const uint8_t* data, size_t len)
+{
+#if BENCH_UART_REF
+    uart_write_bytes(UART_NUM_1, (const char *)data, len);
+    return 0;
+#else
+    softserial_stats_t before;
+    softserial_stats_t after;
+
+    softserial_get_stats(&rx_unit, &before);
+    uint32_t start = ccount();
+    softserial_write(&tx_unit, data, len);
+    uint32_t cycles = ccount() - start;
+    softserial_get_stats(&rx_unit, &after);
+    if (tx_unit.features & SOFTSERIAL_USE_TIMER) {
+        // Queued only, the timer ISR does the work
+        return 0;
+    }
+    // Without the RX interrupts, which preempted the busy waiting
+    return cycles - (uint32_t)(after.isr_cycles - before.isr_cycles);
+#endif
+}
+
+/**
+ * Send one payload and receive it again.
+ */
+static void bench_run(const bench_engine_t* e, uint32_t baudrate, size_t len)
+{
+    softserial_stats_t rx_stats;
+    softserial_stats_t tx_stats;
+    TickType_t timeout;
+    uint32_t bit_errors = 0;
+    size_t got = 0;
+    size_t i;
+
+    if (ESP_OK != setup_units(e, baudrate)) {
+        printf("%-24s %6d %4d  unsupported\n", e->name, baudrate, len);
+        return;
+    }
+    for (i = 0; i < len; i++) {
+        sent[i] = prng();
+    }
+    // Frame time of the payload plus some margin
+    timeout = pdMS_TO_TICKS(((len * 10 * 1000) / baudrate) + 100);
+
+    int64_t start = esp_timer_get_time();
+    uint32_t tx_task_cycles = bench_send(sent, len);
+    while (got < len) {
+        ssize_t n = softserial_read_timeout(&rx_unit, received + got, len - got, timeout);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    for (i = 0; i < got; i++) {
+        bit_errors += __builtin_popcount(sent[i] ^ received[i]);
+    }
+    // Missing bytes count as 8 wrong bits each
+    bit_errors += (len - got) * 8;
+
+    softserial_get_stats(&rx_unit, &rx_stats);
+#if !BENCH_UART_REF
+    softserial_get_stats(&tx_unit, &tx_stats);
+#else
+    memset(&tx_stats, 0, sizeof(tx_stats));
+#endif
+    // The blocking TX engine runs in the task, the timer engine in its ISR
+    uint32_t tx_cycles = tx_task_cycles ? tx_task_cycles : (uint32_t)tx_stats.isr_cycles;
+    // Theoretical maximum for 8N1: 10 bits per byte
+    uint32_t throughput = elapsed ? (uint32_t)((got * 1000000LL) / elapsed) : 0;
+    printf("%-24s %6d %4d  %6d B/s (%3d%%)  BER %.2e  RX %6d cyc/B (max ISR %6d)  TX %6d cyc/B\n",
+            e->name, baudrate, len, throughput, (throughput * 1000) / baudrate,
+            (double)bit_errors / (len * 8),
+            got ? (uint32_t)(rx_stats.isr_cycles / got) : 0, rx_stats.isr_max_cycles,
+            tx_stats.tx_bytes ? (tx_cycles / tx_stats.tx_bytes) : 0);
+    teardown_units();
+}
+
+static void IRAM_ATTR probe_isr(void* arg)
+{
+    if (num_edges < BENCH_MAX_EDGES) {
+        edges[num_edges++] = ccount();
+    }
+}
+
+/**
+ * Measure the deviation of TX edges from the ideal bit grid.
+ * Every 0x55 byte has an edge at every bit boundary.
+ * The RX sample points are not observable from outside the ISRs. Since
+ * TX and RX share the bit timing (hw_timer ticks or CCOUNT deadlines),
+ * the TX edges stand in for them.
+ */
+static void bench_jitter(const bench_engine_t* e, uint32_t baudrate)
+{
+    gpio_config_t conf = {
+        .pin_bit_mask = 1ULL << BENCH_PROBE_PIN,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_ANYEDGE,
+    };
+    uint32_t bit_cycles = esp_clk_cpu_freq() / baudrate;
+    uint32_t max_dev = 0;
+    uint64_t sum_dev = 0;
+    unsigned count = 0;
+    unsigned i;
+
+    memset(&tx_unit, 0, sizeof(tx_unit));
+    tx_unit.features = e->tx_features;
+    tx_unit.baudrate = baudrate;
+    tx_unit.rx_pin = GPIO_NUM_14;
+    tx_unit.tx_pin = BENCH_TX_PIN;
+    tx_unit.tx_buffer = tx_buf;
+    tx_unit.tx_buffer_size = sizeof(tx_buf);
+    if (ESP_OK != softserial_init(&tx_unit)) {
+        printf("%-24s %6d  unsupported\n", e->name, baudrate);
+        return;
+    }
+    gpio_config(&conf);
+    gpio_isr_handler_add(BENCH_PROBE_PIN, probe_isr, NULL);
+
+    memset(sent, 0x55, BENCH_MAX_EDGES / 10);
+    num_edges = 0;
+    softserial_write(&tx_unit, sent, BENCH_MAX_EDGES / 10);
+    vTaskDelay(pdMS_TO_TICKS(((BENCH_MAX_EDGES * 1000) / baudrate) + 20));
+
+    gpio_isr_handler_remove(BENCH_PROBE_PIN);
+    softserial_deinit(&tx_unit);
+
+    // Each frame has 10 edges: start bit, 8 data bits and stop bit
+    for (i = 0; i < num_edges; i++) {
+        uint32_t first = edges[i - (i % 10)];
+        uint32_t ideal = first + ((i % 10) * bit_cycles);
+        uint32_t dev = (edges[i] > ideal) ? (edges[i] - ideal) : (ideal - edges[i]);
+        if (dev > max_dev) {
+            max_dev = dev;
+        }
+        sum_dev += dev;
+        count++;
+    }
+    printf("%-24s %6d  %3d edges  max %5d cyc (%3d%% bit)  mean %5d cyc\n",
+            e->name, baudrate, count, max_dev, (max_dev * 100) / bit_cycles,
+            count ? (uint32_t)(sum_dev / count) : 0);
+}
+
+void app_main(void)
+{
+    unsigned e, b, p;
+
+#if BENCH_UART_REF
+    uart_driver_install(UART_NUM_1, 256, BENCH_BUF_SIZE, 0, NULL, 0);
+#endif
+    // Let the console settle
+    vTaskDelay(pdMS_TO_TICKS(1000));
+
+    printf("\nsoftserial loopback benchmark, CPU at %d MHz\n\n", esp_clk_cpu_freq() / 1000000);
+    printf("%-24s %6s %4s  %s\n", "engine", "baud", "len", "results");
+    for (e = 0; e < (sizeof(engines) / sizeof(engines[0])); e++) {
+        for (b = 0; b < (sizeof(baudrates) / sizeof(baudrates[0])); b++) {
+            for (p = 0; p < (sizeof(payloads) / sizeof(payloads[0])); p++) {
+                bench_run(&engines[e], baudrates[b], payloads[p]);
+            }
+        }
+    }
+
+#if !BENCH_UART_REF
+    printf("\nTX edge jitter (probe pin)\n");
+    for (e = 0; e < (sizeof(engines) / sizeof(engines[0])); e++) {
+        for (b = 0; b < (sizeof(baudrates) / sizeof(baudrates[0])); b++) {
+            bench_jitter(&engines[e], baudrates[b]);
+        }
+    }
+#endif
+    printf("\ndone\n");
+}
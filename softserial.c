@@ -1,340 +1,2854 @@
 #include "softserial.h"
 
+#include <stdio.h>
+#include <string.h>
+
 #include "rom/ets_sys.h"
 #include "driver/gpio.h"
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+#include "driver/hw_timer.h"
+#define LOG_LOCAL_LEVEL SOFTSERIAL_LOG_LEVEL
 #include "esp_log.h"
-#include "esp_timer.h"
+#include "esp_clk.h"
+#include "esp_attr.h"
+#include "esp8266/gpio_struct.h"
+#include "esp8266/eagle_soc.h"
+#include "esp8266/timer_struct.h"
+#include "freertos/task.h"
+#include "esp_sleep.h"
+#if SOFTSERIAL_ENABLE_I2S
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "driver/i2s.h"
+#endif
+
+#if SOFTSERIAL_IRAM
+// Everything reachable from the interrupt handlers
+#define SOFTSERIAL_ISR_ATTR IRAM_ATTR
+#else
+#define SOFTSERIAL_ISR_ATTR
+#endif
 
 /* Log TAG */
 const char* TAG_SOFTSERIAL = "softserial";
 
-static int64_t TMAX = 0x7fffffffffffffff;
+// Number of fractional bits in softserial.bit_cycles
+#define CYCLE_FRAC_BITS 8
 
 // Bitmask of GPIO pins in use (1 = GPIO in use);
 static uint32_t used_pins = 0;
 
 static uint8_t numinstances = 0;
 
+// FRC1 input clock (APB) when using TIMER_CLKDIV_1
+#define HW_TIMER_CLK 80000000
+
+// The units, serviced by the hw_timer
+static softserial* timer_units[SOFTSERIAL_MAX_TIMER_UNITS];
+
+static uint8_t num_timer_units = 0;
+
+// Current tick rate of the hw_timer in Hz and the corresponding FRC1 load value
+static uint32_t tick_rate = 0;
+static uint32_t tick_load = 0;
+
+// true, while the hw_timer is ticking
+static volatile bool timer_running = false;
+
+// true, if the first tick after starting the hw_timer is pending
+static volatile bool timer_rephase = false;
+
+#if SOFTSERIAL_ENABLE_I2S
+// Lowest I2S bit clock in Hz (160 MHz / (63 * 63) with some margin for the divider search)
+#define I2S_MIN_BIT_RATE 50000
+
+// The unit, sending via I2S (only one unit can use the peripheral)
+static softserial* i2s_unit = NULL;
+
+// Encoding buffer for i2s_write(), one DMA buffer in size
+static uint32_t i2s_words[SOFTSERIAL_I2S_DMA_BUF_LEN];
+
+// Complete words in i2s_words, the partial word and its number of bits
+static unsigned i2s_count = 0;
+static uint32_t i2s_acc = 0;
+static unsigned i2s_nbits = 0;
+
+// One DMA buffer of idle bits
+static uint32_t i2s_idle_words[SOFTSERIAL_I2S_DMA_BUF_LEN];
+
+// Idle buffers to write, before the DMA may run out of frames
+static unsigned i2s_idle_owed = 0;
+
+// Timer sending the rest of i2s_words and the idle buffers, and the lock for both
+static TimerHandle_t i2s_timer = NULL;
+static SemaphoreHandle_t i2s_lock = NULL;
+#endif
+
+// Frame flags for SOFTSERIAL_USE_FRAMES
+#define FRAME_ERROR 1    // Parity or framing error within the frame
+#define FRAME_OVERFLOW 2 // RX buffer full
+
+// CRC-16/MODBUS (polynomial 0xA001 reflected), one entry per byte value
+static DRAM_ATTR const uint16_t crc16_table[256] = {
+    0x0000, 0xc0c1, 0xc181, 0x0140, 0xc301, 0x03c0, 0x0280, 0xc241,
+    0xc601, 0x06c0, 0x0780, 0xc741, 0x0500, 0xc5c1, 0xc481, 0x0440,
+    0xcc01, 0x0cc0, 0x0d80, 0xcd41, 0x0f00, 0xcfc1, 0xce81, 0x0e40,
+    0x0a00, 0xcac1, 0xcb81, 0x0b40, 0xc901, 0x09c0, 0x0880, 0xc841,
+    0xd801, 0x18c0, 0x1980, 0xd941, 0x1b00, 0xdbc1, 0xda81, 0x1a40,
+    0x1e00, 0xdec1, 0xdf81, 0x1f40, 0xdd01, 0x1dc0, 0x1c80, 0xdc41,
+    0x1400, 0xd4c1, 0xd581, 0x1540, 0xd701, 0x17c0, 0x1680, 0xd641,
+    0xd201, 0x12c0, 0x1380, 0xd341, 0x1100, 0xd1c1, 0xd081, 0x1040,
+    0xf001, 0x30c0, 0x3180, 0xf141, 0x3300, 0xf3c1, 0xf281, 0x3240,
+    0x3600, 0xf6c1, 0xf781, 0x3740, 0xf501, 0x35c0, 0x3480, 0xf441,
+    0x3c00, 0xfcc1, 0xfd81, 0x3d40, 0xff01, 0x3fc0, 0x3e80, 0xfe41,
+    0xfa01, 0x3ac0, 0x3b80, 0xfb41, 0x3900, 0xf9c1, 0xf881, 0x3840,
+    0x2800, 0xe8c1, 0xe981, 0x2940, 0xeb01, 0x2bc0, 0x2a80, 0xea41,
+    0xee01, 0x2ec0, 0x2f80, 0xef41, 0x2d00, 0xedc1, 0xec81, 0x2c40,
+    0xe401, 0x24c0, 0x2580, 0xe541, 0x2700, 0xe7c1, 0xe681, 0x2640,
+    0x2200, 0xe2c1, 0xe381, 0x2340, 0xe101, 0x21c0, 0x2080, 0xe041,
+    0xa001, 0x60c0, 0x6180, 0xa141, 0x6300, 0xa3c1, 0xa281, 0x6240,
+    0x6600, 0xa6c1, 0xa781, 0x6740, 0xa501, 0x65c0, 0x6480, 0xa441,
+    0x6c00, 0xacc1, 0xad81, 0x6d40, 0xaf01, 0x6fc0, 0x6e80, 0xae41,
+    0xaa01, 0x6ac0, 0x6b80, 0xab41, 0x6900, 0xa9c1, 0xa881, 0x6840,
+    0x7800, 0xb8c1, 0xb981, 0x7940, 0xbb01, 0x7bc0, 0x7a80, 0xba41,
+    0xbe01, 0x7ec0, 0x7f80, 0xbf41, 0x7d00, 0xbdc1, 0xbc81, 0x7c40,
+    0xb401, 0x74c0, 0x7580, 0xb541, 0x7700, 0xb7c1, 0xb681, 0x7640,
+    0x7200, 0xb2c1, 0xb381, 0x7340, 0xb101, 0x71c0, 0x7080, 0xb041,
+    0x5000, 0x90c1, 0x9181, 0x5140, 0x9301, 0x53c0, 0x5280, 0x9241,
+    0x9601, 0x56c0, 0x5780, 0x9741, 0x5500, 0x95c1, 0x9481, 0x5440,
+    0x9c01, 0x5cc0, 0x5d80, 0x9d41, 0x5f00, 0x9fc1, 0x9e81, 0x5e40,
+    0x5a00, 0x9ac1, 0x9b81, 0x5b40, 0x9901, 0x59c0, 0x5880, 0x9841,
+    0x8801, 0x48c0, 0x4980, 0x8941, 0x4b00, 0x8bc1, 0x8a81, 0x4a40,
+    0x4e00, 0x8ec1, 0x8f81, 0x4f40, 0x8d01, 0x4dc0, 0x4c80, 0x8c41,
+    0x4400, 0x84c1, 0x8581, 0x4540, 0x8701, 0x47c0, 0x4680, 0x8641,
+    0x8201, 0x42c0, 0x4380, 0x8341, 0x4100, 0x81c1, 0x8081, 0x4040,
+};
+
+// CRC-8/SMBUS (polynomial 0x07), one entry per byte value
+static DRAM_ATTR const uint8_t crc8_table[256] = {
+    0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15, 0x38, 0x3f, 0x36, 0x31,
+    0x24, 0x23, 0x2a, 0x2d, 0x70, 0x77, 0x7e, 0x79, 0x6c, 0x6b, 0x62, 0x65,
+    0x48, 0x4f, 0x46, 0x41, 0x54, 0x53, 0x5a, 0x5d, 0xe0, 0xe7, 0xee, 0xe9,
+    0xfc, 0xfb, 0xf2, 0xf5, 0xd8, 0xdf, 0xd6, 0xd1, 0xc4, 0xc3, 0xca, 0xcd,
+    0x90, 0x97, 0x9e, 0x99, 0x8c, 0x8b, 0x82, 0x85, 0xa8, 0xaf, 0xa6, 0xa1,
+    0xb4, 0xb3, 0xba, 0xbd, 0xc7, 0xc0, 0xc9, 0xce, 0xdb, 0xdc, 0xd5, 0xd2,
+    0xff, 0xf8, 0xf1, 0xf6, 0xe3, 0xe4, 0xed, 0xea, 0xb7, 0xb0, 0xb9, 0xbe,
+    0xab, 0xac, 0xa5, 0xa2, 0x8f, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9d, 0x9a,
+    0x27, 0x20, 0x29, 0x2e, 0x3b, 0x3c, 0x35, 0x32, 0x1f, 0x18, 0x11, 0x16,
+    0x03, 0x04, 0x0d, 0x0a, 0x57, 0x50, 0x59, 0x5e, 0x4b, 0x4c, 0x45, 0x42,
+    0x6f, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7d, 0x7a, 0x89, 0x8e, 0x87, 0x80,
+    0x95, 0x92, 0x9b, 0x9c, 0xb1, 0xb6, 0xbf, 0xb8, 0xad, 0xaa, 0xa3, 0xa4,
+    0xf9, 0xfe, 0xf7, 0xf0, 0xe5, 0xe2, 0xeb, 0xec, 0xc1, 0xc6, 0xcf, 0xc8,
+    0xdd, 0xda, 0xd3, 0xd4, 0x69, 0x6e, 0x67, 0x60, 0x75, 0x72, 0x7b, 0x7c,
+    0x51, 0x56, 0x5f, 0x58, 0x4d, 0x4a, 0x43, 0x44, 0x19, 0x1e, 0x17, 0x10,
+    0x05, 0x02, 0x0b, 0x0c, 0x21, 0x26, 0x2f, 0x28, 0x3d, 0x3a, 0x33, 0x34,
+    0x4e, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5c, 0x5b, 0x76, 0x71, 0x78, 0x7f,
+    0x6a, 0x6d, 0x64, 0x63, 0x3e, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2c, 0x2b,
+    0x06, 0x01, 0x08, 0x0f, 0x1a, 0x1d, 0x14, 0x13, 0xae, 0xa9, 0xa0, 0xa7,
+    0xb2, 0xb5, 0xbc, 0xbb, 0x96, 0x91, 0x98, 0x9f, 0x8a, 0x8d, 0x84, 0x83,
+    0xde, 0xd9, 0xd0, 0xd7, 0xc2, 0xc5, 0xcc, 0xcb, 0xe6, 0xe1, 0xe8, 0xef,
+    0xfa, 0xfd, 0xf4, 0xf3,
+};
+
+#if SOFTSERIAL_ENABLE_STATS
+#define STAT_INC(s, field) ((s)->stats.field++)
+#else
+#define STAT_INC(s, field) do {} while (0)
+#endif
+
+// RX states of units, serviced by the hw_timer
+typedef enum {
+    RX_STATE_IDLE = 0, // Waiting for a start bit
+    RX_STATE_ACTIVE,   // Receiving a frame
+    RX_STATE_WAIT_IDLE, // Measuring idle time after a received frame
+} rx_state_t;
+
+/**
+ * Read the CPU cycle counter.
+ */
+static inline SOFTSERIAL_ISR_ATTR uint32_t ccount(void)
+{
+    uint32_t r;
+    __asm__ __volatile__("rsr %0, ccount" : "=r"(r));
+    return r;
+}
+
+/**
+ * Calculate the CPU cycles from the start of a frame to a position within it.
+ * @param s Pointer to the corresponding instance.
+ * @param halfbits The position in half bit times.
+ * @return The number of CPU cycles.
+ */
+static inline SOFTSERIAL_ISR_ATTR uint32_t frame_cycles(softserial* s, unsigned halfbits)
+{
+    return (s->bit_cycles * halfbits) >> (CYCLE_FRAC_BITS + 1);
+}
+
+/**
+ * Calculate the bit position of an edge within a frame, rounded to whole bits.
+ * @param s Pointer to the corresponding instance.
+ * @param delta CPU cycles since the start edge of the frame.
+ * @return The bit position (frame_bits + 2 means past the center of the stop bit).
+ */
+static inline SOFTSERIAL_ISR_ATTR unsigned edge_bit(softserial* s, uint32_t delta)
+{
+    if (delta >= frame_cycles(s, (2 * s->frame_bits) + 3)) {
+        return s->frame_bits + 2;
+    }
+    return ((delta << CYCLE_FRAC_BITS) + (s->bit_cycles / 2)) / s->bit_cycles;
+}
+
+/**
+ * Busy wait until CCOUNT has reached a given time (overflow safe).
+ * @param deadline The CCOUNT value to wait for.
+ */
+static inline SOFTSERIAL_ISR_ATTR void wait_until(uint32_t deadline)
+{
+    while ((int32_t)(ccount() - deadline) < 0) {
+    }
+}
+
+/**
+ * Memory barrier for the ring buffers.
+ *
+ * The ring buffers are single-producer/single-consumer: Only the producer
+ * writes tail and only the consumer writes head. The producer must have
+ * stored the data before publishing the new tail and the consumer must
+ * have read the data before publishing the new head. This prevents the
+ * compiler and the CPU from reordering buffer accesses across index updates.
+ */
+static inline SOFTSERIAL_ISR_ATTR void ring_barrier(void)
+{
+    __asm__ __volatile__("memw" ::: "memory");
+}
+
+/**
+ * Check, if RX of a unit is handled by the hw_timer engine.
+ */
+static inline SOFTSERIAL_ISR_ATTR bool rx_uses_timer(softserial* s)
+{
+    return (s->features & (SOFTSERIAL_USE_RX | SOFTSERIAL_USE_TIMER | SOFTSERIAL_USE_EDGES)) ==
+        (SOFTSERIAL_USE_RX | SOFTSERIAL_USE_TIMER);
+}
+
+/**
+ * Check, if TX of a unit is handled by the hw_timer engine.
+ */
+static inline bool tx_uses_timer(softserial* s)
+{
+    return (s->features & (SOFTSERIAL_USE_TX | SOFTSERIAL_USE_TIMER | SOFTSERIAL_USE_I2S)) ==
+        (SOFTSERIAL_USE_TX | SOFTSERIAL_USE_TIMER);
+}
+
+/**
+ * Get the register bitmask of a GPIO pin for pin_read() and pin_write().
+ * @return The bitmask or 0 for GPIO16, which is controlled via the RTC registers.
+ */
+static inline uint16_t pin_mask(gpio_num_t pin)
+{
+    return (pin < GPIO_NUM_16) ? (1 << pin) : 0;
+}
+
+/**
+ * Read the level of a GPIO pin directly from the input register.
+ * @param mask The bitmask of the pin (see pin_mask()).
+ */
+static inline SOFTSERIAL_ISR_ATTR uint8_t pin_read(uint16_t mask)
+{
+    if (mask) {
+        return (GPIO.in & mask) ? 1 : 0;
+    }
+    return READ_PERI_REG(RTC_GPIO_IN_DATA) & 1;
+}
+
+/**
+ * Set the level of a GPIO pin directly via the output registers.
+ * @param mask The bitmask of the pin (see pin_mask()).
+ * @param level 0 or 1
+ */
+static inline SOFTSERIAL_ISR_ATTR void pin_write(uint16_t mask, uint8_t level)
+{
+    if (mask) {
+        if (level) {
+            GPIO.out_w1ts = mask;
+        }
+        else {
+            GPIO.out_w1tc = mask;
+        }
+    }
+    else {
+        WRITE_PERI_REG(RTC_GPIO_OUT, (READ_PERI_REG(RTC_GPIO_OUT) & ~1) | (level & 1));
+    }
+}
+
+/**
+ * Read the logical level of the RX line (1 = idle), honoring SOFTSERIAL_USE_INVERTED.
+ */
+static inline SOFTSERIAL_ISR_ATTR uint8_t rx_level(softserial* s)
+{
+    return pin_read(s->rx_mask) ^ s->line_invert;
+}
+
+/**
+ * Set the logical level of the TX line (1 = idle), honoring SOFTSERIAL_USE_INVERTED.
+ */
+static inline SOFTSERIAL_ISR_ATTR void tx_level(softserial* s, uint8_t level)
+{
+    pin_write(s->tx_mask, level ^ s->line_invert);
+}
+
+/**
+ * Set the interrupt type of the RX pin directly in its pin register.
+ * GPIO_INTR_NEGEDGE denotes the start bit edge, which is a rising
+ * edge on inverted lines. GPIO16 has no pin interrupt.
+ */
+static inline SOFTSERIAL_ISR_ATTR void rx_intr(softserial* s, gpio_int_type_t type)
+{
+    if (s->line_invert && (GPIO_INTR_NEGEDGE == type)) {
+        type = GPIO_INTR_POSEDGE;
+    }
+    if (s->rx_mask) {
+        GPIO.pin[s->rx_pin].int_type = type;
+    }
+}
+
+/**
+ * Ignore the RX pin while sending (SOFTSERIAL_USE_NO_ECHO).
+ * A frame being received is abandoned.
+ */
+static SOFTSERIAL_ISR_ATTR void rx_suspend(softserial* s)
+{
+    rx_intr(s, GPIO_INTR_DISABLE);
+    if (RX_STATE_ACTIVE == s->rx_state) {
+        s->rx_state = RX_STATE_IDLE;
+    }
+    s->rx_edges = 0;
+}
+
+/**
+ * Listen to the RX pin again after rx_suspend().
+ */
+static SOFTSERIAL_ISR_ATTR void rx_resume(softserial* s)
+{
+    if (s->rx_mask) {
+        // Discard edges of our own transmission, latched meanwhile
+        GPIO.status_w1tc = s->rx_mask;
+    }
+    rx_intr(s, (s->features & SOFTSERIAL_USE_EDGES) ? GPIO_INTR_ANYEDGE : GPIO_INTR_NEGEDGE);
+}
+
+/**
+ * Check, if RX of a unit has to be ignored while sending.
+ */
+static inline SOFTSERIAL_ISR_ATTR bool rx_no_echo(softserial* s)
+{
+    // A single wire half-duplex line always echoes TX
+    return (s->features & SOFTSERIAL_USE_RX) &&
+        (s->features & (SOFTSERIAL_USE_NO_ECHO | SOFTSERIAL_USE_OPEN_DRAIN));
+}
+
+/**
+ * Check, if specified GPIO pins are not overlapping or already in use.
+ * @param out_pbm Bitmask of the output pins.
+ * @param in_pbm Bitmask of the input pin.
+ * @param shared_pbm Bitmask of a pin, which is both input and output (single wire) or 0.
+ */
+static esp_err_t check_pins(uint32_t out_pbm, uint32_t in_pbm, uint32_t shared_pbm)
+{
+    if (in_pbm & out_pbm & ~shared_pbm) {
+        ESP_LOGE(TAG_SOFTSERIAL, "TX pin(s) and RX pin must not be the same");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (used_pins & out_pbm) {
+        ESP_LOGE(TAG_SOFTSERIAL, "TX pin(s) already in use");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (used_pins & in_pbm) {
+        ESP_LOGE(TAG_SOFTSERIAL, "RX pin already in use");
+        return ESP_ERR_INVALID_ARG;
+    }
+    used_pins |= (in_pbm | out_pbm);
+    return ESP_OK;
+}
+
+/**
+ * Setup a ring buffer, allocating its storage if none was supplied.
+ * @param b The buffer to setup.
+ * @param data Caller supplied storage or NULL.
+ * @param status Optional caller supplied status storage of the same size or NULL.
+ * @param size Size of the storage (must be a power of 2).
+ * @param defsize Size to allocate, if data is NULL.
+ */
+static esp_err_t buffer_init(volatile softserial_buffer_t* b, uint8_t* data, uint8_t* status,
+        uint16_t size, uint16_t defsize)
+{
+    if (NULL == data) {
+#if SOFTSERIAL_ENABLE_MALLOC
+        size = defsize;
+        data = malloc(size);
+        if (NULL == data) {
+            ESP_LOGE(TAG_SOFTSERIAL, "Unable to allocate buffer");
+            return ESP_ERR_NO_MEM;
+        }
+#else
+        ESP_LOGE(TAG_SOFTSERIAL, "No buffer supplied");
+        return ESP_ERR_INVALID_ARG;
+#endif
+    }
+    else if ((size < 2) || (size > 0x8000) || (size & (size - 1))) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Buffer size must be a power of 2 (%d)", size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    b->data = data;
+    b->status = status;
+    b->mask = size - 1;
+    b->head = 0;
+    b->tail = 0;
+    b->dropped = 0;
+    b->dropped_seen = 0;
+    return ESP_OK;
+}
+
+/**
+ * Store a received byte.
+ * This is the producer side of the RX buffer and must only be called
+ * from the ISR or with interrupts disabled.
+ * @param s Pointer to the corresponding instance.
+ * @param data The received byte.
+ * @param status The SOFTSERIAL_STATUS_xxx flags of the byte.
+ */
+static SOFTSERIAL_ISR_ATTR void rx_put(softserial* s, uint8_t data, uint8_t status)
+{
+    uint16_t tail = s->buffer.tail;
+    uint16_t next = (tail + 1) & s->buffer.mask;
+    if (next != s->buffer.head) {
+        // Save new data in buffer: tail points to where byte goes
+        s->buffer.data[tail] = data;
+        if (s->buffer.status) {
+            s->buffer.status[tail] = status;
+        }
+        ring_barrier();
+        s->buffer.tail = next;
+#if SOFTSERIAL_ENABLE_STATS
+        uint16_t fill = (next - s->buffer.head) & s->buffer.mask;
+        if (fill > s->stats.rx_max_fill) {
+            s->stats.rx_max_fill = fill;
+        }
+#endif
+    }
+    else {
+        // buffer is full, count the dropped byte
+        s->buffer.dropped++;
+    }
+}
+
+/**
+ * Calculate the parity of a value without calling into libgcc.
+ * @return 1, if an odd number of bits is set.
+ */
+static inline SOFTSERIAL_ISR_ATTR uint16_t parity(uint16_t v)
+{
+    v ^= v >> 8;
+    v ^= v >> 4;
+    v ^= v >> 2;
+    v ^= v >> 1;
+    return v & 1;
+}
+
+/**
+ * Add the parity bit (if any) to a data word.
+ * @param s Pointer to the corresponding instance.
+ * @param data The data to send.
+ * @return The bits between start and stop bit (LSB first).
+ */
+static inline SOFTSERIAL_ISR_ATTR uint16_t frame_encode(softserial* s, uint16_t data)
+{
+    data &= (1 << s->data_bits) - 1;
+    if (SOFTSERIAL_PARITY_NONE != s->parity) {
+        uint16_t p = parity(data) ^ (SOFTSERIAL_PARITY_ODD == s->parity);
+        data |= p << s->data_bits;
+    }
+    return data;
+}
+
+/**
+ * Check the bits of a received frame.
+ * @param s Pointer to the corresponding instance.
+ * @param raw The bits between start and stop bit (LSB first).
+ * @param stop The level of the stop bit.
+ * @param data Receives the data bits.
+ * @return The SOFTSERIAL_STATUS_xxx flags.
+ */
+static inline SOFTSERIAL_ISR_ATTR uint8_t frame_decode(softserial* s, uint16_t raw, uint8_t stop, uint16_t* data)
+{
+    uint8_t status = 0;
+
+    *data = raw & ((1 << s->data_bits) - 1);
+    if (SOFTSERIAL_PARITY_NONE != s->parity) {
+        uint16_t p = parity(*data) ^ (SOFTSERIAL_PARITY_ODD == s->parity);
+        if (((raw >> s->data_bits) & 1) != p) {
+            status |= SOFTSERIAL_STATUS_PARITY_ERROR;
+        }
+    }
+    if (!stop) {
+        status |= SOFTSERIAL_STATUS_FRAMING_ERROR;
+    }
+    if (*data & 0x100) {
+        status |= SOFTSERIAL_STATUS_BIT8;
+    }
+    return status;
+}
+
+/**
+ * Wake up a waiting task and signal the event group.
+ * @param s Pointer to the corresponding instance.
+ * @param trigger true, if one of the configured RX triggers has fired.
+ */
+static SOFTSERIAL_ISR_ATTR void rx_wakeup(softserial* s, bool trigger)
+{
+    BaseType_t higherTaskWoken = pdFALSE;
+
+    if (trigger) {
+        s->rx_triggered = 1;
+    }
+    if (s->rx_waiter &&
+            (trigger || (((s->buffer.tail - s->buffer.head) & s->buffer.mask) >= s->rx_wait_count))) {
+        TaskHandle_t waiter = s->rx_waiter;
+        s->rx_waiter = NULL;
+        vTaskNotifyGiveFromISR(waiter, &higherTaskWoken);
+    }
+    if (trigger && s->event_group && s->rx_event) {
+        xEventGroupSetBitsFromISR(s->event_group, s->rx_event, &higherTaskWoken);
+    }
+    if ((pdTRUE == higherTaskWoken) && xPortInIsrContext()) {
+        // Yield to a different task after ISR ends.
+        portYIELD_FROM_ISR();
+    }
+}
+
+/**
+ * Update a CRC-16/MODBUS with one byte.
+ */
+static inline SOFTSERIAL_ISR_ATTR uint16_t crc16_update(uint16_t crc, uint8_t data)
+{
+    return (crc >> 8) ^ crc16_table[(crc ^ data) & 0xff];
+}
+
+/**
+ * Get the initial value of the checksum of a unit.
+ */
+static inline SOFTSERIAL_ISR_ATTR uint32_t checksum_start(softserial* s)
+{
+    if (SOFTSERIAL_CHECKSUM_CRC16 == s->checksum) {
+        return 0xffff;
+    }
+    if (SOFTSERIAL_CHECKSUM_CALLBACK == s->checksum) {
+        return s->checksum_seed;
+    }
+    return 0;
+}
+
+/**
+ * Update the checksum of a unit with one byte.
+ * No switch here, its jump table would end up in flash.
+ */
+static inline SOFTSERIAL_ISR_ATTR uint32_t checksum_update(softserial* s, uint32_t sum, uint8_t data)
+{
+    if (SOFTSERIAL_CHECKSUM_CRC16 == s->checksum) {
+        return crc16_update(sum, data);
+    }
+    if (SOFTSERIAL_CHECKSUM_CRC8 == s->checksum) {
+        return crc8_table[(sum ^ data) & 0xff];
+    }
+    if (SOFTSERIAL_CHECKSUM_XOR == s->checksum) {
+        return (sum ^ data) & 0xff;
+    }
+    if (SOFTSERIAL_CHECKSUM_CALLBACK == s->checksum) {
+        return s->checksum_cb(sum, data);
+    }
+    return sum;
+}
+
+/**
+ * Complete the frame being received (SOFTSERIAL_USE_FRAMES).
+ * A valid frame is published to the consumer, an invalid one is discarded.
+ * Must be called from an ISR or with interrupts disabled.
+ * @param s Pointer to the corresponding instance.
+ */
+static SOFTSERIAL_ISR_ATTR void frame_close(softserial* s)
+{
+    uint8_t qtail = s->frame_qtail;
+    uint8_t qnext = (qtail + 1) & (SOFTSERIAL_MAX_FRAMES - 1);
+
+    if ((s->frame_flags & FRAME_OVERFLOW) || (qnext == s->frame_qhead)) {
+        // No room for this frame
+        s->buffer.dropped += s->frame_bytes;
+        s->frame_tail = s->buffer.tail;
+    }
+    else if ((s->frame_flags & FRAME_ERROR) || ((SOFTSERIAL_CHECKSUM_NONE != s->checksum) &&
+                ((s->frame_bytes < ((SOFTSERIAL_CHECKSUM_CRC16 == s->checksum) ? 3 : 2)) || (0 != s->rx_sum)))) {
+        // Corrupted frame: The checksum over data and appended checksum is 0 for valid frames
+        s->frame_errors++;
+        s->frame_tail = s->buffer.tail;
+    }
+    else {
+        s->frame_len[qtail] = s->frame_bytes;
+        ring_barrier();
+        s->buffer.tail = s->frame_tail;
+        ring_barrier();
+        s->frame_qtail = qnext;
+        rx_wakeup(s, true);
+    }
+    s->frame_bytes = 0;
+    s->frame_flags = 0;
+    s->rx_sum = checksum_start(s);
+}
+
+/**
+ * Add a received byte to the current frame (SOFTSERIAL_USE_FRAMES).
+ * The bytes are stored behind the published tail of the RX buffer, until
+ * the frame is complete. Silence since the last byte completes the previous frame.
+ * @param s Pointer to the corresponding instance.
+ * @param data The data byte.
+ * @param status The SOFTSERIAL_STATUS_xxx flags of the byte.
+ */
+static SOFTSERIAL_ISR_ATTR void frame_store(softserial* s, uint8_t data, uint8_t status)
+{
+    uint16_t tail = s->frame_tail;
+    uint16_t next = (tail + 1) & s->buffer.mask;
+
+    if (s->frame_bytes && ((int32_t)(s->rx_start - s->frame_last) >= (int32_t)s->frame_gap)) {
+        frame_close(s);
+        tail = s->frame_tail;
+        next = (tail + 1) & s->buffer.mask;
+    }
+    s->frame_last = s->rx_start;
+    if (next != s->buffer.head) {
+        s->buffer.data[tail] = data;
+        if (s->buffer.status) {
+            s->buffer.status[tail] = status;
+        }
+        s->frame_tail = next;
+#if SOFTSERIAL_ENABLE_STATS
+        uint16_t fill = (next - s->buffer.head) & s->buffer.mask;
+        if (fill > s->stats.rx_max_fill) {
+            s->stats.rx_max_fill = fill;
+        }
+#endif
+    }
+    else {
+        s->frame_flags |= FRAME_OVERFLOW;
+    }
+    if (status & (SOFTSERIAL_STATUS_PARITY_ERROR | SOFTSERIAL_STATUS_FRAMING_ERROR)) {
+        s->frame_flags |= FRAME_ERROR;
+    }
+    s->rx_sum = checksum_update(s, s->rx_sum, data);
+    s->frame_bytes++;
+}
+
+/**
+ * Store a received byte and notify a waiting task.
+ * @param s Pointer to the corresponding instance.
+ * @param data The received byte.
+ * @param status The SOFTSERIAL_STATUS_xxx flags of the byte.
+ */
+static SOFTSERIAL_ISR_ATTR void rx_store(softserial* s, uint8_t data, uint8_t status)
+{
+    bool trigger = false;
+
+    STAT_INC(s, rx_bytes);
+    if (status & SOFTSERIAL_STATUS_PARITY_ERROR) {
+        STAT_INC(s, parity_errors);
+    }
+    if (status & SOFTSERIAL_STATUS_FRAMING_ERROR) {
+        STAT_INC(s, framing_errors);
+    }
+    if (s->features & SOFTSERIAL_USE_FRAMES) {
+        // One wakeup per frame instead of the per byte triggers
+        frame_store(s, data, status);
+        return;
+    }
+    s->rx_sum = checksum_update(s, s->rx_sum, data);
+    if (s->rx_cb && (SOFTSERIAL_CALLBACK_ISR == s->rx_cb_mode)) {
+        // Deliver directly, bypassing the RX buffer
+        s->rx_cb(s->rx_cb_arg, &data, 1);
+        return;
+    }
+    rx_put(s, data, status);
+    if ((s->rx_triggers & SOFTSERIAL_TRIGGER_DELIMITER) && (data == s->rx_delimiter)) {
+        trigger = true;
+    }
+    if ((s->rx_triggers & SOFTSERIAL_TRIGGER_THRESHOLD) &&
+            (((s->buffer.tail - s->buffer.head) & s->buffer.mask) == s->rx_threshold)) {
+        trigger = true;
+    }
+    rx_wakeup(s, trigger);
+}
+
+/**
+ * Check, store a received frame and notify a waiting task.
+ * @param s Pointer to the corresponding instance.
+ * @param raw The bits between start and stop bit (LSB first).
+ * @param stop The level of the stop bit.
+ */
+static SOFTSERIAL_ISR_ATTR void rx_frame(softserial* s, uint16_t raw, uint8_t stop)
+{
+    uint16_t data;
+    uint8_t status = frame_decode(s, raw, stop, &data);
+
+    if (s->features & SOFTSERIAL_USE_MULTIDROP) {
+        if (status & SOFTSERIAL_STATUS_BIT8) {
+            // Address byte: Select or deselect this node
+            s->rx_selected = !(status & SOFTSERIAL_STATUS_FRAMING_ERROR) &&
+                (((data & 0xff) == s->node_address) || ((data & 0xff) == s->broadcast_address));
+        }
+        if (!s->rx_selected) {
+            // Traffic for other nodes
+            return;
+        }
+    }
+    rx_store(s, data, status);
+}
+
+/**
+ * Account the time, spent in an ISR for a unit.
+ * @param s Pointer to the corresponding instance.
+ * @param cycles The CPU cycles spent.
+ */
+static inline SOFTSERIAL_ISR_ATTR void stats_isr(softserial* s, uint32_t cycles)
+{
+#if SOFTSERIAL_ENABLE_STATS
+    s->stats.isr_count++;
+    s->stats.isr_cycles += cycles;
+    if (cycles > s->stats.isr_max_cycles) {
+        s->stats.isr_max_cycles = cycles;
+    }
+#endif
+}
+
+/**
+ * (Re)start the hw_timer.
+ * @param ticks Number of FRC1 ticks until the next interrupt.
+ * @param reload true, if the timer should fire periodically.
+ */
+static inline SOFTSERIAL_ISR_ATTR void timer_arm(uint32_t ticks, bool reload)
+{
+    // The hw_timer driver functions live in flash, so use the FRC1 registers
+    frc1.ctrl.reload = reload;
+    frc1.load.data = ticks;
+    frc1.ctrl.en = 1;
+}
+
+/**
+ * Start the hw_timer, if it is not already running.
+ * Must be called from an ISR or with interrupts disabled.
+ *
+ * The first tick fires after half a tick period, so the edge which started
+ * the timer is centered between two ticks.
+ */
+static SOFTSERIAL_ISR_ATTR void engine_start(void)
+{
+    if (!timer_running) {
+        timer_running = true;
+        timer_rephase = true;
+        timer_arm(tick_load / 2, true);
+    }
+}
+
+/**
+ * Get the number of ticks per bit, which a unit needs for majority voting.
+ * The samples must cluster around the center of the bit, so voting needs
+ * at least twice as many ticks per bit as samples.
+ * @return The number of ticks or 0, if the unit takes a single sample.
+ */
+static inline SOFTSERIAL_ISR_ATTR uint8_t vote_ticks(softserial* s)
+{
+    return (s->rx_samples > 1) ? (2 * s->rx_samples) : 0;
+}
+
+/**
+ * Get the number of samples, which are actually taken per received bit.
+ * Falls back to a single sample, if the tick rate is too low for voting.
+ */
+static inline SOFTSERIAL_ISR_ATTR uint8_t rx_sample_count(softserial* s)
+{
+    return (s->ticks_per_bit >= vote_ticks(s)) ? s->rx_samples : 1;
+}
+
+/**
+ * Calculate the number of ticks from now to the center of a start bit,
+ * which has just begun.
+ * @param s Pointer to the corresponding instance.
+ * @return The number of ticks (at least 1).
+ */
+static inline SOFTSERIAL_ISR_ATTR uint16_t rx_start_count(softserial* s)
+{
+    // FRC1 counts down, so this is the time until the next tick
+    uint32_t remaining = frc1.count.data;
+    if (remaining > tick_load) {
+        remaining = tick_load;
+    }
+    // Round to the tick, nearest to the center of the start bit
+    uint16_t count = ((((s->ticks_per_bit + 1) * tick_load) / 2) - remaining) / tick_load + 1;
+    uint8_t samples = rx_sample_count(s);
+    if (samples > 1) {
+        // Start with the first of the samples around the center
+        uint16_t before = (samples - 1) / 2;
+        count = (count > before) ? (count - before) : 1;
+    }
+    return count;
+}
+
+/**
+ * Realign the timer sampling of a frame to a falling edge.
+ * Only a 1 to 0 transition between two bits marks a bit boundary, so
+ * the edge must follow a sampled 1 bit and must not hit a vote in progress.
+ * @param s Pointer to the corresponding instance.
+ */
+static SOFTSERIAL_ISR_ATTR void rx_resync(softserial* s)
+{
+    uint8_t bit = s->rx_bit;
+
+    if ((bit >= 2) && (bit <= s->frame_bits) && (0 == s->rx_vote_count) &&
+            (s->rx_data & (1 << (bit - 2)))) {
+        // The bit to be sampled next starts now
+        s->rx_count = rx_start_count(s);
+    }
+}
+
+/**
+ * Start sending the next byte from the TX buffer, if any.
+ * Must be called from the timer ISR or with interrupts disabled.
+ * @param s Pointer to the corresponding instance.
+ * @return true, if a byte is being sent now.
+ */
+static SOFTSERIAL_ISR_ATTR bool tx_start(softserial* s)
+{
+    uint16_t head = s->tx_ring.head;
+    if (head == s->tx_ring.tail) {
+        return false;
+    }
+    ring_barrier();
+    uint16_t data = s->tx_ring.data[head];
+    if (s->tx_ring.status && (s->tx_ring.status[head] & SOFTSERIAL_STATUS_BIT8)) {
+        data |= 0x100;
+    }
+    s->tx_data = frame_encode(s, data);
+    STAT_INC(s, tx_bytes);
+    ring_barrier();
+    s->tx_ring.head = (head + 1) & s->tx_ring.mask;
+    if (!s->tx_active) {
+        if (rx_no_echo(s)) {
+            rx_suspend(s);
+        }
+        if (s->features & SOFTSERIAL_USE_RS485) {
+            // TX enable
+            pin_write(s->rs485_mask, 1);
+        }
+        s->tx_active = 1;
+        engine_start();
+    }
+    // Start bit
+    tx_level(s, 0);
+    s->tx_bit = 0;
+    s->tx_count = s->ticks_per_bit;
+    return true;
+}
+
+/**
+ * Handle one timer tick while sending.
+ * @param s Pointer to the corresponding instance.
+ */
+static SOFTSERIAL_ISR_ATTR void tx_tick(softserial* s)
+{
+    if (--s->tx_count) {
+        return;
+    }
+    s->tx_count = s->ticks_per_bit;
+    s->tx_bit++;
+    if (s->tx_bit <= s->frame_bits) {
+        tx_level(s, s->tx_data & 1);
+        s->tx_data >>= 1;
+    }
+    else if ((s->frame_bits + 1) == s->tx_bit) {
+        // Stop bit(s): 1, 1.5 or 2 bit times, rounded up to a full tick
+        tx_level(s, 1);
+        s->tx_count = ((s->ticks_per_bit * (s->stop_bits + 2)) + 1) / 2;
+    }
+    else if (!tx_start(s)) {
+        // End of stop bit(s) and nothing more to send: Release the bus right now
+        if (s->features & SOFTSERIAL_USE_RS485) {
+            // TX disable
+            pin_write(s->rs485_mask, 0);
+        }
+        if (rx_no_echo(s)) {
+            rx_resume(s);
+        }
+        s->tx_active = 0;
+    }
+}
+
+/**
+ * Handle one bit, sampled in its center.
+ * @param s Pointer to the corresponding instance.
+ * @param level The (majority of the) sampled level(s).
+ */
+static SOFTSERIAL_ISR_ATTR void rx_sample(softserial* s, uint8_t level)
+{
+    if (0 == s->rx_bit) {
+        // Center of start bit
+        if (level) {
+            // Line went high again: This was a glitch, not a start bit
+            s->glitches++;
+            s->rx_state = RX_STATE_IDLE;
+            rx_intr(s, GPIO_INTR_NEGEDGE);
+            return;
+        }
+    }
+    else if (s->rx_bit <= s->frame_bits) {
+        if (level) {
+            s->rx_data |= 1 << (s->rx_bit - 1);
+        }
+    }
+    else {
+        // Center of stop bit: Done with this byte.
+        if ((s->rx_triggers & SOFTSERIAL_TRIGGER_IDLE) || (s->features & SOFTSERIAL_USE_FRAMES)) {
+            // Keep ticking to measure the idle time until the next start bit
+            s->rx_idle = 0;
+            s->rx_state = RX_STATE_WAIT_IDLE;
+        }
+        else {
+            s->rx_state = RX_STATE_IDLE;
+        }
+        // Reactivate interrupts for RX pin
+        rx_intr(s, GPIO_INTR_NEGEDGE);
+        rx_frame(s, s->rx_data, level);
+        return;
+    }
+    s->rx_bit++;
+}
+
+/**
+ * Handle one timer tick while receiving.
+ * @param s Pointer to the corresponding instance.
+ */
+static SOFTSERIAL_ISR_ATTR void rx_tick(softserial* s)
+{
+    if (RX_STATE_WAIT_IDLE == s->rx_state) {
+        if (++s->rx_idle >= ((uint32_t)s->rx_idle_bits * s->ticks_per_bit)) {
+            s->rx_state = RX_STATE_IDLE;
+            if (!(s->features & SOFTSERIAL_USE_FRAMES)) {
+                rx_wakeup(s, true);
+            }
+            else if (s->frame_bytes) {
+                frame_close(s);
+            }
+        }
+        return;
+    }
+    if (--s->rx_count) {
+        return;
+    }
+    uint8_t level = rx_level(s);
+    uint8_t samples = rx_sample_count(s);
+    if (samples > 1) {
+        // Take the samples on consecutive ticks, then let the majority decide
+        s->rx_votes += level;
+        if (++s->rx_vote_count < samples) {
+            s->rx_count = 1;
+            return;
+        }
+        level = (s->rx_votes > (samples / 2)) ? 1 : 0;
+        s->rx_votes = 0;
+        s->rx_vote_count = 0;
+        s->rx_count = s->ticks_per_bit - (samples - 1);
+    }
+    else {
+        s->rx_count = s->ticks_per_bit;
+    }
+    rx_sample(s, level);
+}
+
+/**
+ * The hw_timer ISR, servicing all units using SOFTSERIAL_USE_TIMER.
+ * The timer is stopped as soon as no unit is active anymore.
+ */
+static SOFTSERIAL_ISR_ATTR void softserial_timer_isr(void* arg)
+{
+    bool active = false;
+    unsigned i;
+
+    if (timer_rephase) {
+        // Now continue with the full tick period
+        timer_rephase = false;
+        frc1.load.data = tick_load;
+    }
+    for (i = 0; i < num_timer_units; i++) {
+        softserial* s = timer_units[i];
+        if ((RX_STATE_IDLE == s->rx_state) && !s->tx_active) {
+            continue;
+        }
+#if SOFTSERIAL_ENABLE_STATS
+        uint32_t start = ccount();
+#endif
+        if (RX_STATE_IDLE != s->rx_state) {
+            rx_tick(s);
+        }
+        if (s->tx_active) {
+            tx_tick(s);
+        }
+        if ((RX_STATE_IDLE != s->rx_state) || s->tx_active) {
+            active = true;
+        }
+#if SOFTSERIAL_ENABLE_STATS
+        stats_isr(s, ccount() - start);
+#endif
+    }
+    if (!active) {
+        frc1.ctrl.en = 0;
+        timer_running = false;
+    }
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/**
+ * Calculate the tick rate of the hw_timer engine.
+ *
+ * The tick rate is the least common multiple of the baud rates of all
+ * units, multiplied by SOFTSERIAL_OVERSAMPLE or twice the highest
+ * rx_samples, whichever is larger, but not beyond SOFTSERIAL_MAX_TICK_RATE
+ * just for voting.
+ * @param s Pointer to a new or already registered instance.
+ * @param baudrate The (new) baud rate of this instance.
+ * @return The tick rate in Hz.
+ */
+static uint64_t engine_rate(softserial* s, uint32_t baudrate)
+{
+    uint64_t rate = baudrate;
+    uint8_t oversample = SOFTSERIAL_OVERSAMPLE;
+    unsigned i;
+
+    for (i = 0; i < num_timer_units; i++) {
+        if (timer_units[i] != s) {
+            rate = (rate / gcd(rate, timer_units[i]->baudrate)) * timer_units[i]->baudrate;
+            if (vote_ticks(timer_units[i]) > oversample) {
+                oversample = vote_ticks(timer_units[i]);
+            }
+        }
+    }
+    if (vote_ticks(s) > oversample) {
+        oversample = vote_ticks(s);
+    }
+    if ((rate * oversample > SOFTSERIAL_MAX_TICK_RATE) && (oversample > SOFTSERIAL_OVERSAMPLE)) {
+        // Voting would exceed the cap: Take as many ticks as possible,
+        // units with too few ticks per bit take a single sample.
+        oversample = SOFTSERIAL_MAX_TICK_RATE / rate;
+        if (oversample < SOFTSERIAL_OVERSAMPLE) {
+            oversample = SOFTSERIAL_OVERSAMPLE;
+        }
+    }
+    return rate * oversample;
+}
+
+/**
+ * Switch the hw_timer engine to a new tick rate.
+ * Must be called with interrupts disabled.
+ * @param rate The new tick rate (see engine_rate()).
+ */
+static void engine_apply(uint32_t rate)
+{
+    unsigned i;
+
+    tick_rate = rate;
+    tick_load = (HW_TIMER_CLK + (tick_rate / 2)) / tick_rate;
+    for (i = 0; i < num_timer_units; i++) {
+        timer_units[i]->ticks_per_bit = tick_rate / timer_units[i]->baudrate;
+    }
+    if (timer_running && !timer_rephase) {
+        frc1.load.data = tick_load;
+    }
+}
+
+/**
+ * Check, if a unit is serviced by the hw_timer engine.
+ */
+static bool engine_has(softserial* s)
+{
+    unsigned i;
+
+    for (i = 0; i < num_timer_units; i++) {
+        if (timer_units[i] == s) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Add a unit to the hw_timer engine and recalculate the tick rate.
+ * @param s Pointer to the corresponding instance.
+ */
+static esp_err_t engine_add(softserial* s)
+{
+    esp_err_t ret;
+    uint64_t rate;
+
+    if (num_timer_units >= SOFTSERIAL_MAX_TIMER_UNITS) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Too many units using the hw_timer");
+        return ESP_ERR_NO_MEM;
+    }
+    rate = engine_rate(s, s->baudrate);
+    if (rate > SOFTSERIAL_MAX_TICK_RATE) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Required tick rate too high (%d)", (uint32_t)rate);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (0 == num_timer_units) {
+        ret = hw_timer_init(softserial_timer_isr, NULL);
+        if (ESP_OK != ret) {
+            ESP_LOGE(TAG_SOFTSERIAL, "Failed to init hw_timer");
+            return ret;
+        }
+        hw_timer_enable(false);
+        hw_timer_set_clkdiv(TIMER_CLKDIV_1);
+        hw_timer_set_intr_type(TIMER_EDGE_INT);
+    }
+    s->rx_state = RX_STATE_IDLE;
+    s->rx_votes = 0;
+    s->rx_vote_count = 0;
+    s->tx_active = 0;
+
+    portENTER_CRITICAL();
+    timer_units[num_timer_units++] = s;
+    engine_apply(rate);
+    portEXIT_CRITICAL();
+    ESP_LOGD(TAG_SOFTSERIAL, "tick rate is %d, ticks per bit is %d", tick_rate, s->ticks_per_bit);
+    if (rx_sample_count(s) < s->rx_samples) {
+        ESP_LOGW(TAG_SOFTSERIAL, "Tick rate too low for %d samples per bit, taking 1", s->rx_samples);
+    }
+    return ESP_OK;
+}
+
+/**
+ * Remove a unit from the hw_timer engine and recalculate the tick rate.
+ * The hw_timer is released together with the last unit.
+ * @param s Pointer to the corresponding instance.
+ */
+static void engine_remove(softserial* s)
+{
+    uint64_t rate = 0;
+    unsigned i;
+
+    portENTER_CRITICAL();
+    for (i = 0; i < num_timer_units; i++) {
+        if (timer_units[i] == s) {
+            timer_units[i] = timer_units[--num_timer_units];
+            break;
+        }
+    }
+    if (num_timer_units) {
+        // Removing a unit never raises the tick rate
+        rate = engine_rate(timer_units[0], timer_units[0]->baudrate);
+        engine_apply(rate);
+    }
+    else {
+        frc1.ctrl.en = 0;
+        timer_running = false;
+    }
+    portEXIT_CRITICAL();
+    if (!rate) {
+        hw_timer_deinit();
+    }
+}
+
+/**
+ * Calculate the bit timing for a baud rate and apply it to a unit.
+ * If the unit is already serviced by the hw_timer, its tick rate is updated, too.
+ * @param s Pointer to the corresponding instance.
+ * @param baudrate The new baud rate.
+ */
+static esp_err_t set_timing(softserial* s, uint32_t baudrate)
+{
+    uint32_t bit_time;
+    uint32_t bit_cycles;
+    uint64_t rate = 0;
+
+    if (0 == baudrate) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Invalid baud rate (%d)", baudrate);
+        return ESP_ERR_INVALID_ARG;
+    }
+    bit_time = (1000000 / baudrate);
+    if (((100000000 / baudrate) - (100 * bit_time)) > 50) {
+        bit_time++;
+    }
+    bit_cycles = (((uint64_t)esp_clk_cpu_freq() << CYCLE_FRAC_BITS) + (baudrate / 2)) / baudrate;
+    if (bit_cycles > (UINT32_MAX / 28)) {
+        // frame_cycles() would overflow
+        ESP_LOGE(TAG_SOFTSERIAL, "Baud rate too low (%d)", baudrate);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (engine_has(s)) {
+        rate = engine_rate(s, baudrate);
+        if (rate > SOFTSERIAL_MAX_TICK_RATE) {
+            ESP_LOGE(TAG_SOFTSERIAL, "Required tick rate too high (%d)", (uint32_t)rate);
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+#if SOFTSERIAL_ENABLE_I2S
+    // Send every bit as several I2S bits, if the baud rate is below the I2S clock range
+    uint32_t i2s_oversample = (I2S_MIN_BIT_RATE + baudrate - 1) / baudrate;
+    if ((s->features & SOFTSERIAL_USE_I2S) && (i2s_oversample > UINT8_MAX)) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Baud rate too low for I2S (%d)", baudrate);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+
+    // Silence completing a frame (SOFTSERIAL_USE_FRAMES), measured from the start of
+    // the last byte: Start and frame bits, half of the stop bit and rx_idle_bits.
+    uint64_t gap = ((uint64_t)bit_cycles * ((2 * (s->frame_bits + s->rx_idle_bits)) + 3)) >> (CYCLE_FRAC_BITS + 1);
+
+    portENTER_CRITICAL();
+    s->baudrate = baudrate;
+    s->bit_time = bit_time;
+    s->bit_cycles = bit_cycles;
+    s->frame_gap = (gap > INT32_MAX) ? INT32_MAX : gap;
+    if (rate) {
+        engine_apply(rate);
+    }
+    portEXIT_CRITICAL();
+#if SOFTSERIAL_ENABLE_I2S
+    s->i2s_oversample = i2s_oversample;
+    if (i2s_unit == s) {
+        // 16 bit stereo samples: 32 bits per sample
+        i2s_set_sample_rates(I2S_NUM_0, ((baudrate * i2s_oversample) + 16) / 32);
+    }
+#endif
+    ESP_LOGD(TAG_SOFTSERIAL, "bit_time is %d", s->bit_time);
+    return ESP_OK;
+}
+
+/**
+ * Measure the pulses on the RX pin for softserial_autobaud().
+ * Records the shortest time between two edges, ignoring glitches.
+ * @param s Pointer to the corresponding instance.
+ */
+static SOFTSERIAL_ISR_ATTR void autobaud_isr(softserial* s)
+{
+    uint32_t now = ccount();
+
+    if (s->autobaud < SOFTSERIAL_AUTOBAUD_EDGES) {
+        uint32_t pulse = now - s->autobaud_last;
+        if ((pulse >= s->autobaud_glitch) && (pulse < s->autobaud_min)) {
+            s->autobaud_min = pulse;
+        }
+    }
+    s->autobaud_last = now;
+    if (0 == --s->autobaud) {
+        // Done: Wake the measuring task
+        rx_intr(s, GPIO_INTR_DISABLE);
+        if (s->rx_waiter) {
+            BaseType_t higherTaskWoken = pdFALSE;
+            TaskHandle_t waiter = s->rx_waiter;
+            s->rx_waiter = NULL;
+            vTaskNotifyGiveFromISR(waiter, &higherTaskWoken);
+            if (pdTRUE == higherTaskWoken) {
+                portYIELD_FROM_ISR();
+            }
+        }
+    }
+}
+
+/**
+ * Decode the edges captured for the current frame.
+ *
+ * The bit position of every edge is calculated from its distance to the
+ * start edge. All bits after the last captured edge have the level of that edge.
+ * @param s Pointer to the corresponding instance.
+ * @return The bits between start and stop bit (LSB first).
+ */
+static SOFTSERIAL_ISR_ATTR uint16_t edge_decode(softserial* s)
+{
+    uint32_t t0 = s->edges[0];
+    uint8_t level = 0;
+    uint16_t raw = 0;
+    unsigned bits = s->frame_bits;
+    unsigned bit = 1;
+    unsigned t0_bit = 0;
+    unsigned i;
+
+    for (i = 1; i < s->rx_edges; i++) {
+        unsigned n = t0_bit + edge_bit(s, s->edges[i] - t0);
+        if (n > (bits + 1)) {
+            n = bits + 1;
+        }
+        if ((s->features & SOFTSERIAL_USE_RESYNC) && !(s->edges[i] & 1)) {
+            // Measure the following edges relative to this falling edge
+            t0 = s->edges[i];
+            t0_bit = n;
+        }
+        for (; bit < n; bit++) {
+            if (level) {
+                raw |= 1 << (bit - 1);
+            }
+        }
+        level = s->edges[i] & 1;
+    }
+    for (; bit <= bits; bit++) {
+        if (level) {
+            raw |= 1 << (bit - 1);
+        }
+    }
+    return raw;
+}
+
+/**
+ * Get the line level after the last captured edge.
+ */
+static inline SOFTSERIAL_ISR_ATTR uint8_t edge_level(softserial* s)
+{
+    return s->edges[s->rx_edges - 1] & 1;
+}
+
+/**
+ * RX ISR when using edge timestamps.
+ *
+ * Every edge is recorded with its CCOUNT timestamp (the LSB holds the
+ * new level of the line). A frame is decoded as soon as the rising edge
+ * at the start of its stop bit, or the falling edge of the next start bit
+ * arrives. If the last data bits of a frame are 1, no such edge might
+ * follow at all. In that case, the frame is completed by edge_flush().
+ * @param s Pointer to the corresponding instance.
+ */
+static SOFTSERIAL_ISR_ATTR void edge_isr(softserial* s)
+{
+    uint32_t now = ccount();
+    uint8_t level = rx_level(s);
+
+    if (s->rx_edges) {
+        unsigned bits = s->frame_bits;
+        unsigned n = edge_bit(s, now - s->edges[0]);
+        if (level && (0 == n) && (1 == s->rx_edges)) {
+            // Line went high again within half a bit: A glitch, not a start bit
+            s->glitches++;
+            s->rx_edges = 0;
+            return;
+        }
+        if (level && (n > bits)) {
+            // Rising edge at the start of the stop bit (or too late)
+            rx_frame(s, edge_decode(s), n == (bits + 1));
+            s->rx_edges = 0;
+            return;
+        }
+        if (!level && (n > (bits + 1))) {
+            // Next start bit: The line was unchanged since the last edge.
+            rx_frame(s, edge_decode(s), edge_level(s));
+            s->rx_edges = 0;
+        }
+        else {
+            if (s->rx_edges < SOFTSERIAL_MAX_EDGES) {
+                s->edges[s->rx_edges++] = (now & ~1) | level;
+            }
+            return;
+        }
+    }
+    if (!level) {
+        // Start bit
+        s->edges[0] = now & ~1;
+        s->rx_start = now;
+        s->rx_edges = 1;
+    }
+}
+
+/**
+ * Complete a frame, whose stop bit did not produce an edge.
+ * @param s Pointer to the corresponding instance.
+ */
+static void edge_flush(softserial* s)
+{
+    if (!(s->features & SOFTSERIAL_USE_EDGES) || !s->rx_edges) {
+        return;
+    }
+    portENTER_CRITICAL();
+    // Wait until the center of the stop bit has passed
+    if (s->rx_edges && (ccount() - s->edges[0]) > frame_cycles(s, (2 * s->frame_bits) + 3)) {
+        rx_frame(s, edge_decode(s), edge_level(s));
+        s->rx_edges = 0;
+    }
+    portEXIT_CRITICAL();
+}
+
+/**
+ * Handle an interrupt of the RX pin.
+ * @param s Pointer to the corresponding instance.
+ */
+static SOFTSERIAL_ISR_ATTR void rx_isr(softserial* s)
+{
+    uint8_t level;
+
+    if (s->rx_sleep) {
+        // Level interrupt of the wakeup source: Mask it, or it would fire
+        // as long as the line is active. softserial_wakeup() rearms RX.
+        rx_intr(s, GPIO_INTR_DISABLE);
+        return;
+    }
+    if (s->autobaud) {
+        autobaud_isr(s);
+        return;
+    }
+    if (s->features & SOFTSERIAL_USE_EDGES) {
+        edge_isr(s);
+        return;
+    }
+
+    // Disable interrupts for RX pin
+    rx_intr(s, GPIO_INTR_DISABLE);
+
+    // Check level
+    level = rx_level(s);
+    if (rx_uses_timer(s)) {
+        if (!level && (RX_STATE_ACTIVE == s->rx_state)) {
+            // Falling edge within a frame (SOFTSERIAL_USE_RESYNC)
+            rx_resync(s);
+            rx_intr(s, GPIO_INTR_NEGEDGE);
+            return;
+        }
+        if (!level) {
+            // Start bit: Let the timer sample its center and all following bits.
+            // The pin interrupt gets reactivated by softserial_timer_isr().
+            s->rx_start = ccount();
+            s->rx_bit = 0;
+            s->rx_data = 0;
+            engine_start();
+            s->rx_count = rx_start_count(s);
+            s->rx_state = RX_STATE_ACTIVE;
+            if (s->features & SOFTSERIAL_USE_RESYNC) {
+                rx_intr(s, GPIO_INTR_NEGEDGE);
+            }
+            return;
+        }
+        if (RX_STATE_ACTIVE == s->rx_state) {
+            // Line already high again, the timer is still sampling
+            rx_intr(s, GPIO_INTR_NEGEDGE);
+            return;
+        }
+    }
+    else if (!level) {
+        // Pin is low therefore we have a start bit
+        uint32_t start_time = ccount();
+        s->rx_start = start_time;
+
+        // Verify the start bit in its center before committing to the frame
+        wait_until(start_time + frame_cycles(s, 1));
+        if (rx_level(s)) {
+            // Line went high again: This was a glitch, not a start bit
+            s->glitches++;
+            rx_intr(s, GPIO_INTR_NEGEDGE);
+            return;
+        }
+
+        // Now sample bits (and finally the stop bit) in their center,
+        // relative to the start of bit ref_bit.
+        uint32_t ref = start_time;
+        unsigned ref_bit = 0;
+        unsigned i;
+        uint16_t raw = 0;
+        for (i = 1; i <= (s->frame_bits + 1u); i++) {
+            uint32_t deadline = ref + frame_cycles(s, (2 * (i - ref_bit)) + 1);
+            if ((s->features & SOFTSERIAL_USE_RESYNC) && level) {
+                // A falling edge after a 1 bit marks the start of this bit
+                while ((int32_t)(ccount() - deadline) < 0) {
+                    if (!rx_level(s)) {
+                        ref = ccount();
+                        ref_bit = i;
+                        deadline = ref + frame_cycles(s, 1);
+                        break;
+                    }
+                }
+            }
+            wait_until(deadline);
+            // Read bit
+            level = rx_level(s);
+            if (level && (i <= s->frame_bits)) {
+                raw |= 1 << (i - 1);
+            }
+        }
+        rx_frame(s, raw, level);
+    }
+
+    // Reactivate interrupts for RX pin
+    rx_intr(s, GPIO_INTR_NEGEDGE);
+}
+
+/**
+ * The actual ISR.
+ * @param arg Pointer to the corresponding instance.
+ */
+static SOFTSERIAL_ISR_ATTR void softserial_isr(void* arg)
+{
+    softserial* s = (softserial *)arg;
+#if SOFTSERIAL_ENABLE_STATS
+    uint32_t start = ccount();
+    rx_isr(s);
+    stats_isr(s, ccount() - start);
+#else
+    rx_isr(s);
+#endif
+}
+
+#if SOFTSERIAL_ENABLE_I2S
+/**
+ * Time the DMA needs for shifting out one buffer.
+ * @param s Pointer to the corresponding instance.
+ */
+static uint32_t i2s_buf_us(softserial* s)
+{
+    return ((uint64_t)SOFTSERIAL_I2S_DMA_BUF_LEN * 32 * 1000000) / (s->baudrate * s->i2s_oversample);
+}
+
+/**
+ * Hand the full i2s_words to the driver.
+ * @param ticks Maximum time to wait for a free DMA buffer.
+ * @return true, if the buffer has been written
+ */
+static bool i2s_flush(TickType_t ticks)
+{
+    size_t written = 0;
+
+    i2s_write(I2S_NUM_0, i2s_words, sizeof(i2s_words), &written, ticks);
+    if (sizeof(i2s_words) != written) {
+        return false;
+    }
+    i2s_count = 0;
+    // Every DMA buffer must be overwritten once more, before the DMA runs out of frames
+    i2s_idle_owed = SOFTSERIAL_I2S_DMA_BUF_COUNT;
+    // The DMA might still hold all other buffers with frames
+    i2s_unit->i2s_busy_until = xTaskGetTickCount() +
+        pdMS_TO_TICKS((SOFTSERIAL_I2S_DMA_BUF_COUNT * i2s_buf_us(i2s_unit)) / 1000) + 1;
+    return true;
+}
+
+/**
+ * Append a run of equal bits to the I2S bitstream in i2s_words.
+ * The I2S shifts each 32 bit word out MSB first. Full DMA buffers
+ * are handed to the driver, blocking while its DMA buffers are full.
+ * @param level The level of the bits on the pin.
+ * @param n Number of bits to append.
+ */
+static void i2s_put_bits(uint8_t level, unsigned n)
+{
+    while (n) {
+        unsigned m = 32 - i2s_nbits;
+        if (n < m) {
+            m = n;
+        }
+        i2s_acc = (m < 32) ? (i2s_acc << m) : 0;
+        if (level) {
+            i2s_acc |= 0xFFFFFFFF >> (32 - m);
+        }
+        i2s_nbits += m;
+        n -= m;
+        if (32 == i2s_nbits) {
+            i2s_words[i2s_count++] = i2s_acc;
+            i2s_nbits = 0;
+            if (SOFTSERIAL_I2S_DMA_BUF_LEN == i2s_count) {
+                i2s_flush(portMAX_DELAY);
+            }
+        }
+    }
+}
+
+/**
+ * Complete a partially filled i2s_words with idle bits.
+ * @param level The idle level on the pin.
+ */
+static void i2s_pad(uint8_t level)
+{
+    uint32_t idle = level ? 0xFFFFFFFF : 0;
+
+    if (i2s_nbits) {
+        i2s_words[i2s_count++] = (i2s_acc << (32 - i2s_nbits)) | (idle >> i2s_nbits);
+        i2s_nbits = 0;
+    }
+    while (i2s_count && (i2s_count < SOFTSERIAL_I2S_DMA_BUF_LEN)) {
+        i2s_words[i2s_count++] = idle;
+    }
+}
+
+/**
+ * Write the idle buffers, which are still owed after the last frames.
+ * When running out of data, the DMA keeps cycling through its buffers,
+ * so they must not contain anything else than idle bits.
+ * @param ticks Maximum time to wait for each free DMA buffer.
+ */
+static void i2s_idle(TickType_t ticks)
+{
+    size_t written;
+
+    while (i2s_idle_owed) {
+        written = 0;
+        i2s_write(I2S_NUM_0, i2s_idle_words, sizeof(i2s_idle_words), &written, ticks);
+        if (sizeof(i2s_idle_words) != written) {
+            break;
+        }
+        i2s_idle_owed--;
+    }
+}
+
+/**
+ * Refill timer, running every tick while frames or idle buffers are pending.
+ * It pads and sends the rest of i2s_words and then the owed idle buffers.
+ * Without waiting, only buffers the DMA has already sent are written, so the
+ * idle bits never get in front of frames which are still queued.
+ */
+static void i2s_refill(TimerHandle_t timer)
+{
+    // A write function is busy, try again on the next tick
+    if (pdTRUE != xSemaphoreTake(i2s_lock, 0)) {
+        return;
+    }
+    if (i2s_unit) {
+        i2s_pad(!i2s_unit->line_invert);
+        if ((0 == i2s_count) || i2s_flush(0)) {
+            i2s_idle(0);
+        }
+    }
+    if (!i2s_unit || (!i2s_count && !i2s_idle_owed)) {
+        xTimerStop(timer, 0);
+    }
+    xSemaphoreGive(i2s_lock);
+}
+
+/**
+ * Send a block of frames via I2S DMA.
+ * Either data or data9 must be set. Frames of consecutive calls share the
+ * DMA buffers: Full buffers are handed to the driver right away, the rest is
+ * sent by the refill timer within a tick. At baud rates, where the DMA would
+ * wrap around before the timer gets to refill its buffers, the last buffer
+ * and the idle buffers are written before returning.
+ */
+static esp_err_t i2s_block(softserial* s, const uint8_t* data, const uint16_t* data9, size_t len)
+{
+    uint8_t inv = s->line_invert;
+    unsigned k = s->i2s_oversample;
+    unsigned stop = (((2 + s->stop_bits) * k) + 1) / 2;
+    size_t i;
+    unsigned j;
+
+    xSemaphoreTake(i2s_lock, portMAX_DELAY);
+    if (SOFTSERIAL_I2S_DMA_BUF_LEN == i2s_count) {
+        // Padded by the timer, which found no free DMA buffer
+        i2s_flush(portMAX_DELAY);
+    }
+    for (i = 0; i < len; i++) {
+        uint16_t bits = frame_encode(s, data ? data[i] : data9[i]);
+        // Start bit, data bits (LSB first) and stop bit(s)
+        i2s_put_bits(inv, k);
+        for (j = 0; j < s->frame_bits; j++) {
+            i2s_put_bits((bits & 1) ^ inv, k);
+            bits >>= 1;
+        }
+        i2s_put_bits(!inv, stop);
+        STAT_INC(s, tx_bytes);
+    }
+    if (pdMS_TO_TICKS(((SOFTSERIAL_I2S_DMA_BUF_COUNT - 1) * i2s_buf_us(s)) / 1000) < 2) {
+        // Complete the last buffer with idle bits and overwrite all others
+        i2s_pad(!inv);
+        if (i2s_count) {
+            i2s_flush(portMAX_DELAY);
+        }
+        i2s_idle(portMAX_DELAY);
+    }
+    else if (pdFALSE == xTimerIsTimerActive(i2s_timer)) {
+        xTimerStart(i2s_timer, portMAX_DELAY);
+    }
+    xSemaphoreGive(i2s_lock);
+    return ESP_OK;
+}
+
+/**
+ * Install the I2S driver for sending on GPIO3.
+ * @param s Pointer to the corresponding instance.
+ */
+static esp_err_t i2s_tx_init(softserial* s)
+{
+    esp_err_t ret;
+    i2s_config_t i2s_conf = {
+        .mode = I2S_MODE_MASTER | I2S_MODE_TX,
+        .sample_rate = ((s->baudrate * s->i2s_oversample) + 16) / 32,
+        .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+        .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
+        .communication_format = I2S_COMM_FORMAT_I2S_MSB,
+        .dma_buf_count = SOFTSERIAL_I2S_DMA_BUF_COUNT,
+        .dma_buf_len = SOFTSERIAL_I2S_DMA_BUF_LEN,
+        // Repeat the (idle) buffers instead of sending zeros, which would be a break
+        .tx_desc_auto_clear = false,
+    };
+    i2s_pin_config_t pin_conf = {
+        .bck_o_en = 0,
+        .ws_o_en = 0,
+        .bck_i_en = 0,
+        .ws_i_en = 0,
+        .data_out_en = 1,
+        .data_in_en = 0,
+    };
+
+    // Created once and kept for the next unit, like the GPIO ISR service
+    if (NULL == i2s_lock) {
+        i2s_lock = xSemaphoreCreateMutex();
+    }
+    if (NULL == i2s_timer) {
+        i2s_timer = xTimerCreate("softserial_i2s", 1, pdTRUE, NULL, i2s_refill);
+    }
+    if ((NULL == i2s_lock) || (NULL == i2s_timer)) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Failed to create the I2S refill timer");
+        return ESP_ERR_NO_MEM;
+    }
+    ret = i2s_driver_install(I2S_NUM_0, &i2s_conf, 0, NULL);
+    if (ESP_OK != ret) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Failed to install I2S driver");
+        return ret;
+    }
+    // Keep the pin idle as GPIO, until the DMA buffers contain idle bits
+    tx_level(s, 1);
+    memset(i2s_idle_words, s->line_invert ? 0x00 : 0xFF, sizeof(i2s_idle_words));
+    i2s_count = 0;
+    i2s_nbits = 0;
+    i2s_idle_owed = SOFTSERIAL_I2S_DMA_BUF_COUNT;
+    i2s_idle(portMAX_DELAY);
+    ret = i2s_set_pin(I2S_NUM_0, &pin_conf);
+    if (ESP_OK != ret) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Failed to route I2S to GPIO3");
+        i2s_driver_uninstall(I2S_NUM_0);
+        return ret;
+    }
+    s->i2s_busy_until = xTaskGetTickCount();
+    i2s_unit = s;
+    return ESP_OK;
+}
+
+/**
+ * Send the rest of the frames and uninstall the I2S driver.
+ * The refill timer and its lock stay for the next unit.
+ */
+static void i2s_tx_deinit(softserial* s)
+{
+    xSemaphoreTake(i2s_lock, portMAX_DELAY);
+    xTimerStop(i2s_timer, portMAX_DELAY);
+    i2s_pad(!s->line_invert);
+    if (i2s_count) {
+        i2s_flush(portMAX_DELAY);
+    }
+    i2s_idle(portMAX_DELAY);
+    i2s_driver_uninstall(I2S_NUM_0);
+    i2s_unit = NULL;
+    xSemaphoreGive(i2s_lock);
+}
+#endif
+
+/**
+ * Release everything a failed softserial_init() has set up.
+ * @param s Pointer to the corresponding instance.
+ * @param pins The pins, reserved by check_pins().
+ * @param ret The error code to return.
+ * @return ret
+ */
+static esp_err_t init_undo(softserial* s, uint32_t pins, esp_err_t ret)
+{
+    if (s->features & SOFTSERIAL_USE_RX) {
+        rx_intr(s, GPIO_INTR_DISABLE);
+    }
+#if SOFTSERIAL_ENABLE_I2S
+    if (i2s_unit == s) {
+        i2s_tx_deinit(s);
+    }
+#endif
+    if (engine_has(s)) {
+        engine_remove(s);
+    }
+#if SOFTSERIAL_ENABLE_MALLOC
+    if (s->buffer.data && (NULL == s->rx_buffer)) {
+        free(s->buffer.data);
+    }
+    if (s->tx_ring.data && (NULL == s->tx_buffer)) {
+        free(s->tx_ring.data);
+    }
+#endif
+    s->buffer.data = NULL;
+    s->tx_ring.data = NULL;
+    used_pins &= ~pins;
+    return ret;
+}
+
+esp_err_t softserial_init(softserial* s)
+{
+
+    esp_err_t ret;
+    uint32_t pins;
+    gpio_config_t tx_gpio_conf = {
+        .pin_bit_mask = 1ULL << s->tx_pin,
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    gpio_config_t rx_gpio_conf = {
+        .pin_bit_mask = 1ULL << s->rx_pin,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    if (s->initialized) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Unit is already initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s->features & SOFTSERIAL_USE_RS485) {
+        tx_gpio_conf.pin_bit_mask |= (1ULL << s->rs485_pin);
+    }
+    if (s->features & SOFTSERIAL_USE_EDGES) {
+        rx_gpio_conf.intr_type = GPIO_INTR_ANYEDGE;
+    }
+    else if (s->features & SOFTSERIAL_USE_INVERTED) {
+        // The start bit begins with a rising edge
+        rx_gpio_conf.intr_type = GPIO_INTR_POSEDGE;
+    }
+    if (s->features & SOFTSERIAL_USE_INVERTED) {
+        // Idle low: An external pull-down may be needed, GPIO16 has an internal one
+        tx_gpio_conf.pull_up_en = GPIO_PULLUP_DISABLE;
+        rx_gpio_conf.pull_up_en = GPIO_PULLUP_DISABLE;
+        if (GPIO_NUM_16 == s->rx_pin) {
+            rx_gpio_conf.pull_down_en = GPIO_PULLDOWN_ENABLE;
+        }
+    }
+    if (s->features & SOFTSERIAL_USE_OPEN_DRAIN) {
+        if ((s->tx_pin != s->rx_pin) || (GPIO_NUM_16 == s->rx_pin) ||
+                (s->features & (SOFTSERIAL_USE_RS485 | SOFTSERIAL_USE_INVERTED | SOFTSERIAL_USE_I2S))) {
+            ESP_LOGE(TAG_SOFTSERIAL, "Open drain mode requires tx_pin == rx_pin (not GPIO16), no RS485, inversion or I2S");
+            return ESP_ERR_INVALID_ARG;
+        }
+        // TX pulls the line low or releases it to the pull-up, RX keeps listening
+        tx_gpio_conf.mode = GPIO_MODE_OUTPUT_OD;
+        if (s->features & SOFTSERIAL_USE_TX) {
+            // The input of a GPIO is always enabled
+            rx_gpio_conf.mode = GPIO_MODE_OUTPUT_OD;
+        }
+    }
+
+    // Frame format
+    if (0 == s->data_bits) {
+        s->data_bits = 8;
+    }
+    if ((s->data_bits < 5) || (s->data_bits > 9) ||
+            (s->parity > SOFTSERIAL_PARITY_ODD) || (s->stop_bits > SOFTSERIAL_STOP_BITS_2)) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Invalid frame format");
+        return ESP_ERR_INVALID_ARG;
+    }
+    s->frame_bits = s->data_bits + ((SOFTSERIAL_PARITY_NONE != s->parity) ? 1 : 0);
+    if ((s->features & SOFTSERIAL_USE_MULTIDROP) && (9 != s->data_bits)) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Multidrop mode requires 9 data bits");
+        return ESP_ERR_INVALID_ARG;
+    }
+    s->rx_selected = 0;
+    s->glitches = 0;
+    s->autobaud = 0;
+    s->buffer.data = NULL;
+    s->tx_ring.data = NULL;
+    s->rx_state = RX_STATE_IDLE;
+    s->rx_edges = 0;
+    s->rx_cb = NULL;
+    s->rx_task = NULL;
+    s->rx_sleep = 0;
+#if SOFTSERIAL_ENABLE_STATS
+    memset(&s->stats, 0, sizeof(s->stats));
+#endif
+
+    if ((s->checksum > SOFTSERIAL_CHECKSUM_CALLBACK) ||
+            ((SOFTSERIAL_CHECKSUM_CALLBACK == s->checksum) && (NULL == s->checksum_cb))) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Invalid checksum");
+        return ESP_ERR_INVALID_ARG;
+    }
+    s->rx_sum = checksum_start(s);
+    if ((s->features & SOFTSERIAL_USE_FRAMES) && (!(s->features & SOFTSERIAL_USE_RX) || (0 == s->rx_idle_bits))) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Frame mode requires RX and rx_idle_bits > 0");
+        return ESP_ERR_INVALID_ARG;
+    }
+    s->frame_bytes = 0;
+    s->frame_flags = 0;
+    s->frame_qhead = 0;
+    s->frame_qtail = 0;
+    s->frame_errors = 0;
+
+    if (s->features & SOFTSERIAL_USE_I2S) {
+#if SOFTSERIAL_ENABLE_I2S
+        if (!(s->features & SOFTSERIAL_USE_TX) || (GPIO_NUM_3 != s->tx_pin) || i2s_unit) {
+            ESP_LOGE(TAG_SOFTSERIAL, "I2S TX requires TX on GPIO3 and is available for one unit only");
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (s->features & (SOFTSERIAL_USE_RS485 | SOFTSERIAL_USE_NO_ECHO)) {
+            ESP_LOGE(TAG_SOFTSERIAL, "I2S TX does not support RS485 and no echo mode");
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+#else
+        ESP_LOGE(TAG_SOFTSERIAL, "I2S TX requires SOFTSERIAL_ENABLE_I2S");
+        return ESP_ERR_NOT_SUPPORTED;
+#endif
+    }
+
+    // Set bit time
+    ret = set_timing(s, s->baudrate);
+    if (ESP_OK != ret) {
+        return ret;
+    }
+    if (0 == s->rx_samples) {
+        s->rx_samples = 1;
+    }
+    if ((1 != s->rx_samples) && (3 != s->rx_samples) && (5 != s->rx_samples)) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Invalid number of samples (%d)", s->rx_samples);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((s->rx_samples > 1) && !rx_uses_timer(s)) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Oversampling requires SOFTSERIAL_USE_TIMER");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (0 == s->rx_triggers) {
+        // Default: Notify on linefeed
+        s->rx_triggers = SOFTSERIAL_TRIGGER_DELIMITER;
+        s->rx_delimiter = '\n';
+    }
+    if ((s->rx_triggers & SOFTSERIAL_TRIGGER_IDLE) && (!rx_uses_timer(s) || (0 == s->rx_idle_bits))) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Idle trigger requires SOFTSERIAL_USE_TIMER and rx_idle_bits > 0");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    ret = check_pins(tx_gpio_conf.pin_bit_mask, rx_gpio_conf.pin_bit_mask,
+            (s->features & SOFTSERIAL_USE_OPEN_DRAIN) ? rx_gpio_conf.pin_bit_mask : 0);
+    if (ESP_OK != ret) {
+        return ret;
+    }
+    // From here on, failures release what has been set up so far
+    pins = tx_gpio_conf.pin_bit_mask | rx_gpio_conf.pin_bit_mask;
+    s->line_invert = (s->features & SOFTSERIAL_USE_INVERTED) ? 1 : 0;
+    s->rx_mask = pin_mask(s->rx_pin);
+    s->tx_mask = pin_mask(s->tx_pin);
+    s->rs485_mask = pin_mask(s->rs485_pin);
+
+    if (s->features & SOFTSERIAL_USE_RX) {
+        ret = buffer_init(&s->buffer, s->rx_buffer, s->rx_status_buffer,
+                s->rx_buffer_size, SOFTSERIAL_MAX_RX_BUF);
+        if (ESP_OK != ret) {
+            return init_undo(s, pins, ret);
+        }
+        s->frame_tail = 0;
+    }
+    if (tx_uses_timer(s)) {
+        ret = buffer_init(&s->tx_ring, s->tx_buffer, s->tx_status_buffer,
+                s->tx_buffer_size, SOFTSERIAL_MAX_TX_BUF);
+        if (ESP_OK != ret) {
+            return init_undo(s, pins, ret);
+        }
+    }
+
+    if (s->features & SOFTSERIAL_USE_TIMER) {
+        ret = engine_add(s);
+        if (ESP_OK != ret) {
+            return init_undo(s, pins, ret);
+        }
+    }
+
+    if (0 == numinstances) {
+        ret = gpio_install_isr_service(0);
+        // ESP_ERR_INVALID_STATE means already installed,
+        // which is harmless.
+        if (ESP_OK != ret && ESP_ERR_INVALID_STATE != ret) {
+            return init_undo(s, pins, ret);
+        }
+    }
+
+    if (s->features & SOFTSERIAL_USE_TX) {
+        // Init TX pin and possibly RS485 TX enable pin
+        ESP_LOGD(TAG_SOFTSERIAL, "TX init");
+        // Idle level before enabling the output
+        tx_level(s, 1);
+        ret = gpio_config(&tx_gpio_conf);
+        if (ESP_OK != ret) {
+            ESP_LOGE(TAG_SOFTSERIAL, "Invalid TX setup");
+            return init_undo(s, pins, ret);
+        }
+#if SOFTSERIAL_ENABLE_I2S
+        if (s->features & SOFTSERIAL_USE_I2S) {
+            ret = i2s_tx_init(s);
+            if (ESP_OK != ret) {
+                return init_undo(s, pins, ret);
+            }
+        }
+#endif
+        ESP_LOGD(TAG_SOFTSERIAL, "TX init done");
+    }
+
+    if (s->features & SOFTSERIAL_USE_RX) {
+        // Init RX pin
+        ESP_LOGD(TAG_SOFTSERIAL, "RX init");
+        ret = gpio_config(&rx_gpio_conf);
+        if (ESP_OK != ret) {
+            ESP_LOGE(TAG_SOFTSERIAL, "Invalid RX setup");
+            return init_undo(s, pins, ret);
+        }
+        ESP_LOGD(TAG_SOFTSERIAL, "RX init done");
+        // Register ISR
+        ESP_LOGD(TAG_SOFTSERIAL, "register ISR");
+        ret = gpio_isr_handler_add(s->rx_pin, softserial_isr, (void *)s);
+        if (ESP_OK != ret) {
+            ESP_LOGE(TAG_SOFTSERIAL, "Failed to add ISR handler");
+            return init_undo(s, pins, ret);
+        }
+    }
+    numinstances++;
+    s->initialized = 1;
+
+    if (LOG_LOCAL_LEVEL >= ESP_LOG_INFO) {
+        // Formatted on the stack, init does not touch the heap for logging
+        char rx_txt[24], tx_txt[24], rs485_txt[28];
+        snprintf(rx_txt, sizeof(rx_txt), (s->features & SOFTSERIAL_USE_RX) ?
+                "RX enabled on GPIO%d" : "RX disabled", s->rx_pin);
+        snprintf(tx_txt, sizeof(tx_txt), (s->features & SOFTSERIAL_USE_TX) ?
+                "TX enabled on GPIO%d" : "TX disabled", s->tx_pin);
+        snprintf(rs485_txt, sizeof(rs485_txt), (s->features & SOFTSERIAL_USE_RS485) ?
+                "RS485 enabled on GPIO%d" : "RS485 disabled", s->rs485_pin);
+        ESP_LOGI(TAG_SOFTSERIAL, "initialized. %s, %s, %s", rx_txt, tx_txt, rs485_txt);
+    }
+    return ESP_OK;
+}
+
+
+
+uint8_t softserial_getc(softserial* s)
+{
+    edge_flush(s);
+    uint16_t head = s->buffer.head;
+    // Empty buffer?
+    if (head == s->buffer.tail) {
+        return 0;
+    }
+
+    // Fetch next byte from head
+    ring_barrier();
+    uint8_t d = s->buffer.data[head];
+    ring_barrier();
+    s->buffer.head = (head + 1) & s->buffer.mask;
+    return d;
+}
+
+// Is data available?
+uint16_t softserial_available(softserial* s)
+{
+    edge_flush(s);
+    return (s->buffer.tail - s->buffer.head) & s->buffer.mask;
+}
+
+/**
+ * Append data to the TX buffer and start the timer, if it is idle.
+ * Either data or data9 must be set.
+ * @param s The unit to use for sending.
+ * @param data The bytes to send or NULL.
+ * @param data9 The 9-bit words to send or NULL.
+ * @param len The number of bytes or words.
+ * @return Number of bytes queued.
+ */
+static size_t tx_queue(softserial* s, const uint8_t* data, const uint16_t* data9, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++) {
+        uint16_t tail = s->tx_ring.tail;
+        uint16_t next = (tail + 1) & s->tx_ring.mask;
+        if (next == s->tx_ring.head) {
+            // buffer is full
+            break;
+        }
+        s->tx_ring.data[tail] = data ? data[i] : data9[i];
+        if (s->tx_ring.status) {
+            s->tx_ring.status[tail] = (data9 && (data9[i] & 0x100)) ? SOFTSERIAL_STATUS_BIT8 : 0;
+        }
+        ring_barrier();
+        s->tx_ring.tail = next;
+    }
+    portENTER_CRITICAL();
+    if (!s->tx_active) {
+        tx_start(s);
+    }
+    portEXIT_CRITICAL();
+    return i;
+}
+
+/**
+ * Queue data, waiting for free space in the TX buffer if necessary.
+ * Either data or data9 must be set.
+ */
+static esp_err_t tx_queue_all(softserial* s, const uint8_t* data, const uint16_t* data9, size_t len)
+{
+    while (len) {
+        size_t n = tx_queue(s, data, data9, len);
+        if (data) {
+            data += n;
+        }
+        else {
+            data9 += n;
+        }
+        len -= n;
+        if (len) {
+            vTaskDelay(1);
+        }
+    }
+    return ESP_OK;
+}
+
+uint16_t softserial_tx_free(softserial* s)
+{
+    if (!tx_uses_timer(s)) {
+        return 0;
+    }
+    return (s->tx_ring.head - s->tx_ring.tail - 1) & s->tx_ring.mask;
+}
+
+uint16_t softserial_tx_capacity(softserial* s)
+{
+    if (!tx_uses_timer(s)) {
+        return 0;
+    }
+    // One slot is kept free to tell a full from an empty ring
+    return s->tx_ring.mask;
+}
+
+/**
+ * Send a single frame by busy waiting.
+ * @param s The unit to use for sending.
+ * @param bits The bits between start and stop bit (see frame_encode()).
+ * @param start_time The CCOUNT value, when the start bit should begin.
+ */
+static void tx_frame(softserial* s, uint16_t bits, uint32_t start_time)
+{
+    unsigned i;
+
+    // Start Bit
+    wait_until(start_time);
+    tx_level(s, 0);
+    for (i = 0; i < s->frame_bits; i ++ ) {
+        wait_until(start_time + frame_cycles(s, 2 * (i + 1)));
+        tx_level(s, bits & 1);
+        bits >>= 1;
+    }
+
+    // Stop bit
+    wait_until(start_time + frame_cycles(s, 2 * (i + 1)));
+    tx_level(s, 1);
+}
+
+/**
+ * Send a block of frames back-to-back by busy waiting.
+ * If RS485 is enabled, TX stays enabled for the whole block.
+ * Either data or data9 must be set.
+ */
+static esp_err_t tx_block(softserial* s, const uint8_t* data, const uint16_t* data9, size_t len)
+{
+    uint32_t start_time;
+    size_t i;
+
+    if (rx_no_echo(s)) {
+        rx_suspend(s);
+    }
+    if (s->features & SOFTSERIAL_USE_RS485) {
+        // TX enable
+        pin_write(s->rs485_mask, 1);
+    }
+
+    start_time = ccount();
+    for (i = 0; i < len; i++) {
+        tx_frame(s, frame_encode(s, data ? data[i] : data9[i]), start_time);
+        STAT_INC(s, tx_bytes);
+        // Next start bit immediately follows the stop bit(s)
+        start_time += frame_cycles(s, (2 * (s->frame_bits + 1)) + 2 + s->stop_bits);
+    }
+
+    if (s->features & (SOFTSERIAL_USE_RS485 | SOFTSERIAL_USE_NO_ECHO)) {
+        // Wait until the last stop bit is complete
+        wait_until(start_time);
+    }
+    if (s->features & SOFTSERIAL_USE_RS485) {
+        // TX disable
+        pin_write(s->rs485_mask, 0);
+    }
+    if (rx_no_echo(s)) {
+        rx_resume(s);
+    }
+    return ESP_OK;
+}
+
+esp_err_t softserial_putchar(softserial* s, uint8_t data)
+{
+    if (!(s->features & SOFTSERIAL_USE_TX)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+#if SOFTSERIAL_ENABLE_I2S
+    if (s->features & SOFTSERIAL_USE_I2S) {
+        return i2s_block(s, &data, NULL, 1);
+    }
+#endif
+    if (tx_uses_timer(s)) {
+        return tx_queue_all(s, &data, NULL, 1);
+    }
+    return tx_block(s, &data, NULL, 1);
+}
+
+ssize_t softserial_write(softserial* s, const uint8_t* data, size_t len)
+{
+    if (!(s->features & SOFTSERIAL_USE_TX)) {
+        return -1;
+    }
+#if SOFTSERIAL_ENABLE_I2S
+    if (s->features & SOFTSERIAL_USE_I2S) {
+        i2s_block(s, data, NULL, len);
+        return len;
+    }
+#endif
+    if (tx_uses_timer(s)) {
+        return tx_queue(s, data, NULL, len);
+    }
+    if (ESP_OK != tx_block(s, data, NULL, len)) {
+        return -1;
+    }
+    return len;
+}
+
+ssize_t softserial_write9(softserial* s, const uint16_t* data, size_t len)
+{
+    if (!(s->features & SOFTSERIAL_USE_TX)) {
+        return -1;
+    }
+#if SOFTSERIAL_ENABLE_I2S
+    if (s->features & SOFTSERIAL_USE_I2S) {
+        i2s_block(s, NULL, data, len);
+        return len;
+    }
+#endif
+    if (tx_uses_timer(s)) {
+        return tx_queue(s, NULL, data, len);
+    }
+    if (ESP_OK != tx_block(s, NULL, data, len)) {
+        return -1;
+    }
+    return len;
+}
+
+esp_err_t softserial_puts(softserial* s, const uint8_t* str)
+{
+    size_t len = strlen((const char *)str);
+    if (!(s->features & SOFTSERIAL_USE_TX)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+#if SOFTSERIAL_ENABLE_I2S
+    if (s->features & SOFTSERIAL_USE_I2S) {
+        return i2s_block(s, str, NULL, len);
+    }
+#endif
+    if (tx_uses_timer(s)) {
+        return tx_queue_all(s, str, NULL, len);
+    }
+    return tx_block(s, str, NULL, len);
+}
+
+uint8_t softserial_overrun(softserial *s)
+{
+    // Only the ISR increments dropped and only we write dropped_seen,
+    // so there is nothing to reset, which could race with the ISR.
+    uint32_t dropped = s->buffer.dropped;
+    if (dropped != s->buffer.dropped_seen) {
+        s->buffer.dropped_seen = dropped;
+        return 1;
+    }
+    return 0;
+}
+
+uint32_t softserial_dropped(softserial *s)
+{
+    return s->buffer.dropped;
+}
+
+uint32_t softserial_glitches(softserial *s)
+{
+    return s->glitches;
+}
+
+esp_err_t softserial_get_stats(softserial* s, softserial_stats_t* stats)
+{
+#if SOFTSERIAL_ENABLE_STATS
+    portENTER_CRITICAL();
+    *stats = s->stats;
+    portEXIT_CRITICAL();
+    stats->dropped = s->buffer.dropped;
+    stats->glitches = s->glitches;
+    stats->frame_errors = s->frame_errors;
+    return ESP_OK;
+#else
+    memset(stats, 0, sizeof(*stats));
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void softserial_reset_stats(softserial* s)
+{
+#if SOFTSERIAL_ENABLE_STATS
+    portENTER_CRITICAL();
+    memset(&s->stats, 0, sizeof(s->stats));
+    portEXIT_CRITICAL();
+#endif
+}
+
+uint32_t softserial_frame_errors(softserial *s)
+{
+    return s->frame_errors;
+}
+
+uint32_t softserial_checksum(softserial* s)
+{
+    return s->rx_sum;
+}
+
+void softserial_checksum_reset(softserial* s)
+{
+    portENTER_CRITICAL();
+    s->rx_sum = checksum_start(s);
+    portEXIT_CRITICAL();
+}
+
+uint32_t softserial_checksum_calc(softserial* s, const uint8_t* data, size_t len)
+{
+    uint32_t sum = checksum_start(s);
+    while (len--) {
+        sum = checksum_update(s, sum, *data++);
+    }
+    return sum;
+}
+
+uint16_t softserial_crc16(uint16_t crc, const uint8_t* data, size_t len)
+{
+    while (len--) {
+        crc = crc16_update(crc, *data++);
+    }
+    return crc;
+}
+
 /**
- * Check, if specified GPIO pins are not overlapping or already in use.
+ * Copy the status of a contiguous segment of the RX buffer.
+ * @param s The unit to use for reading.
+ * @param status The buffer to fill (nothing is copied if this was NULL).
+ * @param head The first index of the segment.
+ * @param n The length of the segment.
  */
-static esp_err_t check_pins(uint32_t out_pbm, uint32_t in_pbm)
+static inline void rx_drain_status(softserial* s, uint8_t* status, uint16_t head, size_t n)
 {
-    if (in_pbm & out_pbm) {
-        ESP_LOGE(TAG_SOFTSERIAL, "TX pin(s) and RX pin must not be the same");
-        return ESP_ERR_INVALID_ARG;
-    }
-    if (used_pins & out_pbm) {
-        ESP_LOGE(TAG_SOFTSERIAL, "TX pin(s) already in use");
-        return ESP_ERR_INVALID_ARG;
-    }
-    if (used_pins & in_pbm) {
-        ESP_LOGE(TAG_SOFTSERIAL, "RX pin already in use");
-        return ESP_ERR_INVALID_ARG;
+    if (status) {
+        if (s->buffer.status) {
+            memcpy(status, &s->buffer.status[head], n);
+        }
+        else {
+            memset(status, 0, n);
+        }
     }
-    used_pins |= (in_pbm | out_pbm);
-    return ESP_OK;
 }
 
 /**
- * The actual ISR.
- * @param s Pointer to the corresponding instance.
+ * Copy received data in contiguous segments of the RX buffer.
+ * @param s The unit to use for reading.
+ * @param buffer The buffer to fill with the received data.
+ * @param status If not NULL, the buffer to fill with the status of the received data.
+ * @param maxlen The maximum number of bytes to copy.
+ * @param delim If >= 0, stop after this delimiter (which is consumed but not copied).
+ * @param keep If nonzero, the delimiter is copied as well.
+ * @param found If not NULL, set to true if the delimiter has been consumed.
+ * @return Number of bytes copied.
  */
-static void softserial_isr(void* arg)
+static size_t rx_drain(softserial* s, uint8_t* buffer, uint8_t* status, size_t maxlen,
+        int delim, uint8_t keep, bool* found)
 {
-    softserial* s = (softserial *)arg;
-    uint8_t level;
-
-    // Disable interrupts for RX pin
-    gpio_set_intr_type(s->rx_pin, GPIO_INTR_DISABLE);
-
-    // Check level
-    level = gpio_get_level(s->rx_pin);
-    if (!level) {
-        // Pin is low therefore we have a start bit
-        // Wait till start bit is half over so we can sample the next one in the center
-        os_delay_us(s->bit_time / 2);
+    size_t len = 0;
+    uint16_t head = s->buffer.head;
+    // Snapshot tail once, anything arriving later is left for the next call.
+    uint16_t tail = s->buffer.tail;
+    ring_barrier();
 
-        // Now sample bits
-        unsigned i;
-        uint8_t data = 0;
-        uint64_t start_time = TMAX & esp_timer_get_time();
-        for (i = 0; i < 8; i++) {
-            while ((TMAX & esp_timer_get_time()) < (start_time + (s->bit_time * (i + 1)))) {
-                if ((TMAX & esp_timer_get_time()) < start_time) {
-                    // Timer overflow: escape from while loop
-                    break;
-                }
-            }
-            data >>= 1;
-            // Read bit
-            if (gpio_get_level(s->rx_pin)) {
-                data |= 0x80;
-            }
-        }
-        uint8_t next = (s->buffer.tail + 1) % SOFTSERIAL_MAX_RX_BUF;
-        if (next != s->buffer.head) {
-            // Save new data in buffer: tail points to where byte goes
-            s->buffer.data[s->buffer.tail] = data;
-            s->buffer.tail = next;
+    while ((len < maxlen) && (head != tail)) {
+        const uint8_t* src = &s->buffer.data[head];
+        size_t n = ((head <= tail) ? tail : (s->buffer.mask + 1)) - head;
+        if (n > (maxlen - len)) {
+            n = maxlen - len;
         }
-        else {
-            // buffer is full, set the overrun flag
-            s->buffer.overrun = 1;
-        }
-        // Wait for stop bit
-        os_delay_us(s->bit_time / 2);
-        if (data == '\n') {
-            if (s->event_group && s->rx_event) {
-                BaseType_t higherTaskWoken = pdFALSE;
-                BaseType_t r = xEventGroupSetBitsFromISR(s->event_group, s->rx_event, &higherTaskWoken);
-                if (r == pdTRUE && pdTRUE == higherTaskWoken) {
-                    // Yield to a different task after ISR ends.
-                    portYIELD_FROM_ISR();
+        if (delim >= 0) {
+            const uint8_t* d = memchr(src, delim, n);
+            if (d) {
+                n = d - src + 1;
+                memcpy(buffer + len, src, keep ? n : n - 1);
+                rx_drain_status(s, status ? status + len : NULL, head, keep ? n : n - 1);
+                len += keep ? n : n - 1;
+                head = (head + n) & s->buffer.mask;
+                if (found) {
+                    *found = true;
                 }
+                break;
             }
         }
+        memcpy(buffer + len, src, n);
+        rx_drain_status(s, status ? status + len : NULL, head, n);
+        len += n;
+        head = (head + n) & s->buffer.mask;
     }
+    ring_barrier();
+    s->buffer.head = head;
+    return len;
+}
 
-    // Reactivate interrupts for RX pin
-    gpio_set_intr_type(s->rx_pin, GPIO_INTR_NEGEDGE);
+static inline ssize_t read_internal(softserial* s, uint8_t* buffer, size_t maxlen, uint8_t checklf)
+{
+    size_t len;
+    if (softserial_overrun(s)) {
+        return -1;
+    }
+
+    edge_flush(s);
+    len = rx_drain(s, buffer, NULL, maxlen - 1, checklf ? '\n' : -1, 0, NULL);
+    // Terminate string
+    buffer[len] = '\0';
+
+    return len;
 }
 
-esp_err_t softserial_init(softserial* s)
+ssize_t softserial_readline(softserial* s, uint8_t* buffer, size_t maxlen)
 {
+    return read_internal(s, buffer, maxlen, 1);
+}
 
-    esp_err_t ret;
-    gpio_config_t tx_gpio_conf = {
-        .pin_bit_mask = 1ULL << s->tx_pin,
-        .mode = GPIO_MODE_OUTPUT,
-        .pull_up_en = GPIO_PULLUP_ENABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE,
-    };
-    gpio_config_t rx_gpio_conf = {
-        .pin_bit_mask = 1ULL << s->rx_pin,
-        .mode = GPIO_MODE_INPUT,
-        .pull_up_en = GPIO_PULLUP_ENABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_NEGEDGE,
-    };
-    if (s->features & SOFTSERIAL_USE_RS485) {
-        tx_gpio_conf.pin_bit_mask |= (1ULL << s->rs485_pin);
-    }
-    ret = check_pins(tx_gpio_conf.pin_bit_mask, rx_gpio_conf.pin_bit_mask);
-    if (ESP_OK != ret) {
-        return ret;
-    }
+ssize_t softserial_read(softserial* s, uint8_t* buffer, size_t maxlen)
+{
+    return read_internal(s, buffer, maxlen, 0);
+}
 
-    // Set bit time
-    if (s->baudrate <= 0) {
-        ESP_LOGE(TAG_SOFTSERIAL, "Invalid baud rate (%d)", s->baudrate);
-        return ESP_ERR_INVALID_ARG;
-    }
-    else {
-        s->bit_time = (1000000 / s->baudrate);
-        if (((100000000 / s->baudrate) - (100 * s->bit_time)) > 50) {
-            s->bit_time++;
-        }
-        ESP_LOGD(TAG_SOFTSERIAL, "bit_time is %d", s->bit_time);
+ssize_t softserial_read_status(softserial* s, uint8_t* buffer, uint8_t* status, size_t len)
+{
+    if (softserial_overrun(s)) {
+        return -1;
     }
+    edge_flush(s);
+    return rx_drain(s, buffer, status, len, -1, 0, NULL);
+}
 
-    if (0 == numinstances) {
-        ret = gpio_install_isr_service(0);
-        // ESP_ERR_INVALID_STATE means already installed,
-        // which is harmless.
-        if (ESP_OK != ret && ESP_ERR_INVALID_STATE != ret) {
-            return ret;
-        }
-    }
-    numinstances++;
+uint16_t softserial_peek(softserial* s, const uint8_t** data)
+{
+    edge_flush(s);
+    uint16_t head = s->buffer.head;
+    uint16_t tail = s->buffer.tail;
+    ring_barrier();
+    *data = &s->buffer.data[head];
+    return ((head <= tail) ? tail : (s->buffer.mask + 1)) - head;
+}
 
-    if (s->features & SOFTSERIAL_USE_TX) {
-        // Init TX pin and possibly RS485 TX enable pin
-        ESP_LOGD(TAG_SOFTSERIAL, "TX init");
-        ret = gpio_config(&tx_gpio_conf);
-        if (ESP_OK != ret) {
-            ESP_LOGE(TAG_SOFTSERIAL, "Invalid TX setup");
-            return ret;
-        }
-        ESP_LOGD(TAG_SOFTSERIAL, "TX init done");
+void softserial_commit(softserial* s, uint16_t len)
+{
+    uint16_t avail = (s->buffer.tail - s->buffer.head) & s->buffer.mask;
+    if (len > avail) {
+        len = avail;
     }
+    ring_barrier();
+    s->buffer.head = (s->buffer.head + len) & s->buffer.mask;
+}
 
-    if (s->features & SOFTSERIAL_USE_RX) {
-        // Init RX pin
-        ESP_LOGD(TAG_SOFTSERIAL, "RX init");
-        ret = gpio_config(&rx_gpio_conf);
-        if (ESP_OK != ret) {
-            ESP_LOGE(TAG_SOFTSERIAL, "Invalid RX setup");
-            return ret;
+ssize_t softserial_read_timeout(softserial* s, uint8_t* buffer, size_t len, TickType_t ticks)
+{
+    size_t got = 0;
+    bool found = false;
+    int delim = (s->rx_triggers & SOFTSERIAL_TRIGGER_DELIMITER) ? s->rx_delimiter : -1;
+    TimeOut_t timeout;
+
+    if (softserial_overrun(s)) {
+        return -1;
+    }
+    s->rx_triggered = 0;
+    vTaskSetTimeOutState(&timeout);
+    for (;;) {
+        edge_flush(s);
+        got += rx_drain(s, buffer + got, NULL, len - got, delim, 1, &found);
+        if (found || (got >= len) || (s->rx_triggered && got)) {
+            break;
         }
-        ESP_LOGD(TAG_SOFTSERIAL, "RX init done");
-        // Register ISR
-        ESP_LOGD(TAG_SOFTSERIAL, "register ISR");
-        ret = gpio_isr_handler_add(s->rx_pin, softserial_isr, (void *)s);
-        if (ESP_OK != ret) {
-            ESP_LOGE(TAG_SOFTSERIAL, "Failed to add ISR handler");
-            return ret;
+        // Register as waiter, then check again to not miss data arriving meanwhile.
+        s->rx_wait_count = ((len - got) > s->buffer.mask) ? s->buffer.mask : (len - got);
+        s->rx_waiter = xTaskGetCurrentTaskHandle();
+        if (softserial_available(s) >= s->rx_wait_count) {
+            s->rx_waiter = NULL;
+            continue;
         }
+        if (pdTRUE == xTaskCheckForTimeOut(&timeout, &ticks)) {
+            s->rx_waiter = NULL;
+            break;
+        }
+        // A frame without trailing edge is only completed by polling.
+        ulTaskNotifyTake(pdTRUE, s->rx_edges ? 1 : ticks);
+        s->rx_waiter = NULL;
     }
-    char *rx_txt, *tx_txt, *rs485_txt;
-    rx_txt = tx_txt = rs485_txt = NULL;
-    asprintf(&rx_txt, (s->features & SOFTSERIAL_USE_RX) ?
-            "RX enabled on GPIO%d" : "RX disabled", s->rx_pin);
-    asprintf(&tx_txt, (s->features & SOFTSERIAL_USE_TX) ?
-            "TX enabled on GPIO%d" : "TX disabled", s->tx_pin);
-    asprintf(&rs485_txt, (s->features & SOFTSERIAL_USE_RS485) ?
-            "RS485 enabled on GPIO%d" : "RS485 disabled", s->rs485_pin);
-    ESP_LOGI(TAG_SOFTSERIAL, "initialized. %s, %s, %s", rx_txt, tx_txt, rs485_txt);
-    free(rx_txt);
-    free(tx_txt);
-    free(rs485_txt);
-    return ESP_OK;
+    return got;
 }
 
+esp_err_t softserial_autobaud(softserial* s, TickType_t ticks)
+{
+    static const uint32_t rates[] = {
+        300, 600, 1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400, 57600, 76800, 115200
+    };
+    uint32_t freq = esp_clk_cpu_freq();
+    uint32_t measured;
+    TimeOut_t timeout;
+    bool done;
+    unsigned i;
 
+    if (!(s->features & SOFTSERIAL_USE_RX)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    s->autobaud_min = UINT32_MAX;
+    // Anything shorter than half a bit at the highest rate is a glitch
+    s->autobaud_glitch = freq / (2 * rates[(sizeof(rates) / sizeof(rates[0])) - 1]);
 
-uint8_t softserial_getc(softserial* s)
-{
-    // Empty buffer?
-    if (s->buffer.head == s->buffer.tail) {
-        return 0;
+    portENTER_CRITICAL();
+    // Abandon any frame in progress and measure all edges
+    s->rx_edges = 0;
+    s->rx_state = RX_STATE_IDLE;
+    s->rx_waiter = xTaskGetCurrentTaskHandle();
+    s->autobaud = SOFTSERIAL_AUTOBAUD_EDGES;
+    rx_intr(s, GPIO_INTR_ANYEDGE);
+    portEXIT_CRITICAL();
+
+    vTaskSetTimeOutState(&timeout);
+    while (s->autobaud && (pdTRUE != xTaskCheckForTimeOut(&timeout, &ticks))) {
+        ulTaskNotifyTake(pdTRUE, ticks);
     }
 
-    // Fetch next byte from head
-    uint8_t d = s->buffer.data[s->buffer.head];
-    s->buffer.head = (s->buffer.head + 1) % SOFTSERIAL_MAX_RX_BUF;
-    return d;
-}
+    portENTER_CRITICAL();
+    done = (0 == s->autobaud);
+    s->autobaud = 0;
+    s->rx_waiter = NULL;
+    rx_intr(s, (s->features & SOFTSERIAL_USE_EDGES) ? GPIO_INTR_ANYEDGE : GPIO_INTR_NEGEDGE);
+    portEXIT_CRITICAL();
 
-// Is data available?
-uint8_t softserial_available(softserial* s)
-{
-    return (s->buffer.tail + SOFTSERIAL_MAX_RX_BUF - s->buffer.head) % SOFTSERIAL_MAX_RX_BUF;
+    if (!done) {
+        return ESP_ERR_TIMEOUT;
+    }
+    if (UINT32_MAX == s->autobaud_min) {
+        ESP_LOGW(TAG_SOFTSERIAL, "No valid pulse for autobaud");
+        return ESP_ERR_NOT_FOUND;
+    }
+    measured = (freq + (s->autobaud_min / 2)) / s->autobaud_min;
+    for (i = 0; i < (sizeof(rates) / sizeof(rates[0])); i++) {
+        // Accept a deviation of 1/16 (6.25%)
+        uint32_t tolerance = rates[i] / 16;
+        if ((measured >= (rates[i] - tolerance)) && (measured <= (rates[i] + tolerance))) {
+            ESP_LOGI(TAG_SOFTSERIAL, "Detected %d baud (measured %d)", rates[i], measured);
+            return set_timing(s, rates[i]);
+        }
+    }
+    ESP_LOGW(TAG_SOFTSERIAL, "No standard baud rate near %d", measured);
+    return ESP_ERR_NOT_FOUND;
 }
 
-static inline uint8_t chbit(uint8_t data, uint8_t bit)
+esp_err_t softserial_set_baudrate(softserial* s, uint32_t baudrate)
 {
-    if ((data & bit) != 0) {
-        return 1;
-    }
-    else {
-        return 0;
+    if (!s->initialized) {
+        return ESP_ERR_INVALID_STATE;
     }
+    return set_timing(s, baudrate);
 }
 
-esp_err_t softserial_putchar(softserial* s, uint8_t data)
+esp_err_t softserial_deinit(softserial* s)
 {
-    esp_err_t ret;
-    unsigned i;
-    int64_t start_time = TMAX & esp_timer_get_time();
+    uint32_t pins = (1 << s->tx_pin) | (1 << s->rx_pin);
 
+    if (!s->initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
     if (s->features & SOFTSERIAL_USE_RS485) {
-        // TX enable
-        ret = gpio_set_level(s->rs485_pin, 1);
-        if (ESP_OK != ret) {
-            return ret;
-        }
+        pins |= (1 << s->rs485_pin);
     }
-
-    // Start Bit
-    ret = gpio_set_level(s->tx_pin, 0);
-    if (ESP_OK != ret) {
-        return ret;
+    if (s->features & SOFTSERIAL_USE_RX) {
+        softserial_set_rx_callback(s, NULL, NULL, SOFTSERIAL_CALLBACK_ISR);
+        softserial_wakeup(s);
+        rx_intr(s, GPIO_INTR_DISABLE);
+        gpio_isr_handler_remove(s->rx_pin);
+        s->autobaud = 0;
     }
-    for (i = 0; i < 8; i ++ ) {
-        while ((TMAX & esp_timer_get_time()) < (start_time + (s->bit_time*(i+1)))) {
-            // Timer overflow: escape from while loop
-            if ((TMAX & esp_timer_get_time()) < start_time) {
-                break;
-            }
-        }
-        ret = gpio_set_level(s->tx_pin, chbit(data, 1 << i));
-        if (ESP_OK != ret) {
-            return ret;
+    if (engine_has(s)) {
+        // Let the timer engine finish sending, what has been queued
+        while (s->tx_active) {
+            vTaskDelay(1);
         }
+        engine_remove(s);
+    }
+    if (s->features & SOFTSERIAL_USE_RS485) {
+        // TX disable
+        pin_write(s->rs485_mask, 0);
     }
+#if SOFTSERIAL_ENABLE_I2S
+    if (i2s_unit == s) {
+        i2s_tx_deinit(s);
+    }
+#endif
 
-    // Stop bit
-    while ((TMAX & esp_timer_get_time()) < (start_time + (s->bit_time*9))) {
-        // Timer overflow: escape from while loop
-        if ((TMAX & esp_timer_get_time()) < start_time) {
-            break;
-        }
+#if SOFTSERIAL_ENABLE_MALLOC
+    // Free buffers, allocated by softserial_init()
+    if ((s->features & SOFTSERIAL_USE_RX) && (NULL == s->rx_buffer)) {
+        free(s->buffer.data);
     }
-    ret = gpio_set_level(s->tx_pin, 1);
-    if (ESP_OK != ret) {
-        return ret;
+    if (tx_uses_timer(s) && (NULL == s->tx_buffer)) {
+        free(s->tx_ring.data);
     }
+#endif
+    s->buffer.data = NULL;
+    s->tx_ring.data = NULL;
 
-    // Delay after byte, for new sync
-    os_delay_us(s->bit_time * 6);
+    used_pins &= ~pins;
+    // The GPIO ISR service stays installed, the application may use it, too
+    numinstances--;
+    s->initialized = 0;
+    ESP_LOGI(TAG_SOFTSERIAL, "deinitialized");
+    return ESP_OK;
+}
 
-    if (s->features & SOFTSERIAL_USE_RS485) {
-        // TX disable
-        ret = gpio_set_level(s->rs485_pin, 0);
-        if (ESP_OK != ret) {
-            return ret;
-        }
+/**
+ * Complete the current frame, if the line has been silent long enough.
+ * Without the hw_timer, nothing else notices the silence after the last frame.
+ * @param s Pointer to the corresponding instance.
+ */
+static void frame_flush(softserial* s)
+{
+    edge_flush(s);
+    portENTER_CRITICAL();
+    // A byte being received belongs to the current frame, if it started before the silence.
+    bool receiving = (RX_STATE_ACTIVE == s->rx_state) || s->rx_edges;
+    if (s->frame_bytes && ((int32_t)(ccount() - s->frame_last) >= (int32_t)s->frame_gap) &&
+            !(receiving && ((int32_t)(s->rx_start - s->frame_last) < (int32_t)s->frame_gap))) {
+        frame_close(s);
     }
-    return ESP_OK;
+    portEXIT_CRITICAL();
 }
 
-esp_err_t softserial_puts(softserial* s, const uint8_t* str)
+ssize_t softserial_read_frame(softserial* s, uint8_t* buffer, size_t len, TickType_t ticks)
 {
-    while (*str) {
-        int ret = softserial_putchar(s, *(str++));
-        if (ESP_OK != ret) {
-            return ret;
+    TimeOut_t timeout;
+    uint8_t qhead;
+    size_t n;
+    size_t got;
+
+    if (!(s->features & SOFTSERIAL_USE_FRAMES)) {
+        return -1;
+    }
+    vTaskSetTimeOutState(&timeout);
+    for (;;) {
+        frame_flush(s);
+        if (s->frame_qhead != s->frame_qtail) {
+            break;
+        }
+        // Only complete frames wake us up.
+        s->rx_wait_count = s->buffer.mask + 1;
+        s->rx_waiter = xTaskGetCurrentTaskHandle();
+        if (s->frame_qhead != s->frame_qtail) {
+            s->rx_waiter = NULL;
+            break;
+        }
+        if (pdTRUE == xTaskCheckForTimeOut(&timeout, &ticks)) {
+            s->rx_waiter = NULL;
+            return 0;
         }
+        // Without the hw_timer, the end of a frame is only detected by polling.
+        ulTaskNotifyTake(pdTRUE, (s->frame_bytes && !rx_uses_timer(s)) ? 1 : ticks);
+        s->rx_waiter = NULL;
     }
-    return ESP_OK;
+
+    qhead = s->frame_qhead;
+    ring_barrier();
+    n = s->frame_len[qhead];
+    got = rx_drain(s, buffer, NULL, (n < len) ? n : len, -1, 1, NULL);
+    if (n > got) {
+        // Discard the part of the frame not fitting into buffer
+        ring_barrier();
+        s->buffer.head = (s->buffer.head + (n - got)) & s->buffer.mask;
+    }
+    ring_barrier();
+    s->frame_qhead = (qhead + 1) & (SOFTSERIAL_MAX_FRAMES - 1);
+    return got;
 }
 
-uint8_t softserial_overrun(softserial *s)
+/**
+ * The task for delivering received data to the RX callback (SOFTSERIAL_CALLBACK_TASK).
+ * All data received while the callback runs is delivered by the next call.
+ */
+static void rx_task(void* arg)
 {
-    uint8_t ret = s->buffer.overrun;
-    if (ret) {
-        s->buffer.overrun = 0;
+    softserial* s = (softserial *)arg;
+    uint8_t frame[SOFTSERIAL_RX_TASK_FRAME];
+    bool frames = (s->features & SOFTSERIAL_USE_FRAMES);
+
+    while (!s->rx_task_stop) {
+        // softserial_set_rx_callback() may clear it at any time
+        softserial_rx_cb_t cb = s->rx_cb;
+        if (NULL == cb) {
+            break;
+        }
+        if (frames) {
+            frame_flush(s);
+            if (s->frame_qhead != s->frame_qtail) {
+                ssize_t n = softserial_read_frame(s, frame, sizeof(frame), 0);
+                if (n > 0) {
+                    cb(s->rx_cb_arg, frame, n);
+                }
+                continue;
+            }
+        }
+        else {
+            const uint8_t* data;
+            uint16_t n = softserial_peek(s, &data);
+            if (n) {
+                cb(s->rx_cb_arg, data, n);
+                softserial_commit(s, n);
+                continue;
+            }
+        }
+        // Register as waiter for a byte (a frame), then check again to not miss anything.
+        s->rx_wait_count = frames ? (s->buffer.mask + 1) : 1;
+        s->rx_waiter = xTaskGetCurrentTaskHandle();
+        if (frames ? (s->frame_qhead != s->frame_qtail) : (s->buffer.head != s->buffer.tail)) {
+            s->rx_waiter = NULL;
+            continue;
+        }
+        // Frames and frames without a trailing edge are only completed by polling.
+        ulTaskNotifyTake(pdTRUE, ((frames && s->frame_bytes && !rx_uses_timer(s)) || s->rx_edges) ?
+                1 : portMAX_DELAY);
+        s->rx_waiter = NULL;
     }
-    return ret;
+    s->rx_task = NULL;
+    vTaskDelete(NULL);
 }
 
-static inline ssize_t read_internal(softserial* s, uint8_t* buffer, size_t maxlen, uint8_t checklf)
+esp_err_t softserial_set_rx_callback(softserial* s, softserial_rx_cb_t cb, void* arg, uint8_t mode)
 {
-    uint8_t ch;
-    size_t len = 0;
-    if (softserial_overrun(s)) {
-        return -1;
+    bool in_task;
+
+    if (!(s->features & SOFTSERIAL_USE_RX) || (mode > SOFTSERIAL_CALLBACK_TASK)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (cb && (SOFTSERIAL_CALLBACK_ISR == mode) && (s->features & SOFTSERIAL_USE_FRAMES)) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Frames can only be delivered by the RX task");
+        return ESP_ERR_NOT_SUPPORTED;
     }
 
-    while (softserial_available(s)) {
-        ch = softserial_getc(s);
+    // Called from the callback of the RX task, which must not wait for itself
+    in_task = s->rx_task && (xTaskGetCurrentTaskHandle() == s->rx_task);
 
-        if (checklf && (ch == '\n')) {
-            break;
+    // Stop the current callback
+    portENTER_CRITICAL();
+    s->rx_task_stop = 1;
+    s->rx_cb = NULL;
+    portEXIT_CRITICAL();
+    if (s->rx_task && !in_task) {
+        xTaskNotifyGive(s->rx_task);
+        while (s->rx_task) {
+            vTaskDelay(1);
         }
-        else if (len < maxlen - 1) {
-            *buffer++ = ch;
-            len++;
+    }
+    if (NULL == cb) {
+        // From within the callback, the RX task exits, once the callback returns
+        return ESP_OK;
+    }
+
+    s->rx_cb_arg = arg;
+    s->rx_cb_mode = mode;
+    if (SOFTSERIAL_CALLBACK_TASK == mode) {
+        s->rx_task_stop = 0;
+        s->rx_cb = cb;
+        if (in_task) {
+            // Keep the running RX task, it uses the new callback from now on
+            return ESP_OK;
         }
-        else {
-            break;
+        if (pdPASS != xTaskCreate(rx_task, "softserial_rx", SOFTSERIAL_RX_TASK_STACK, s,
+                    SOFTSERIAL_RX_TASK_PRIORITY, (TaskHandle_t *)&s->rx_task)) {
+            s->rx_cb = NULL;
+            ESP_LOGE(TAG_SOFTSERIAL, "Unable to create RX task");
+            return ESP_ERR_NO_MEM;
         }
     }
-    // Terminate string
-    *buffer++ = '\0';
+    else {
+        portENTER_CRITICAL();
+        s->rx_cb = cb;
+        portEXIT_CRITICAL();
+    }
+    return ESP_OK;
+}
 
-    return len;
+bool softserial_tx_idle(softserial* s)
+{
+    if (tx_uses_timer(s)) {
+        return !s->tx_active && (s->tx_ring.head == s->tx_ring.tail);
+    }
+#if SOFTSERIAL_ENABLE_I2S
+    if (i2s_unit == s) {
+        // Nothing left for the refill timer and the last buffer with frames has drained
+        return (0 == i2s_count) && (0 == i2s_nbits) && (0 == i2s_idle_owed) &&
+            ((int32_t)(xTaskGetTickCount() - s->i2s_busy_until) >= 0);
+    }
+#endif
+    // Blocking TX returns after the last stop bit has been started
+    return true;
 }
 
-ssize_t softserial_readline(softserial* s, uint8_t* buffer, size_t maxlen)
+esp_err_t softserial_prepare_sleep(softserial* s)
 {
-    return read_internal(s, buffer, maxlen, 1);
+    esp_err_t ret;
+
+    if (!(s->features & SOFTSERIAL_USE_RX) || (0 == s->rx_mask)) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Wakeup requires RX on GPIO0 .. GPIO15");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    // Complete a frame, which ended with 1 bits
+    edge_flush(s);
+    portENTER_CRITICAL();
+    // Pending idle detection (RX_STATE_WAIT_IDLE) has to complete, too
+    if ((RX_STATE_IDLE != s->rx_state) || s->rx_edges || s->autobaud || !softserial_tx_idle(s)) {
+        portEXIT_CRITICAL();
+        return ESP_ERR_INVALID_STATE;
+    }
+    // From now on, the pin interrupt only signals the wakeup level
+    s->rx_sleep = 1;
+    portEXIT_CRITICAL();
+
+    ret = gpio_wakeup_enable(s->rx_pin, s->line_invert ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+    if (ESP_OK == ret) {
+        ret = esp_sleep_enable_gpio_wakeup();
+    }
+    if (ESP_OK != ret) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Failed to enable wakeup on GPIO%d", s->rx_pin);
+        softserial_wakeup(s);
+    }
+    return ret;
 }
 
-ssize_t softserial_read(softserial* s, uint8_t* buffer, size_t maxlen)
+void softserial_wakeup(softserial* s)
 {
-    return read_internal(s, buffer, maxlen, 0);
+    if (!s->rx_sleep) {
+        return;
+    }
+    gpio_wakeup_disable(s->rx_pin);
+    portENTER_CRITICAL();
+    s->rx_sleep = 0;
+    rx_resume(s);
+    portEXIT_CRITICAL();
 }
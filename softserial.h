@@ -2,36 +2,252 @@
 
 #include <FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <freertos/task.h>
 #include <driver/gpio.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Default RX buffer size, if no buffer is supplied (power of 2)
 #define SOFTSERIAL_MAX_RX_BUF 64
 
+// Default TX buffer size, if no buffer is supplied (power of 2)
+#define SOFTSERIAL_MAX_TX_BUF 64
+
+// Place the interrupt handlers and everything they call in IRAM (1) or flash (0).
+// With 1, RX and TX keep working while the SPI flash is busy (e.g. OTA, NVS).
+#ifndef SOFTSERIAL_IRAM
+#define SOFTSERIAL_IRAM 1
+#endif
+
+// Allocate missing buffers on the heap in softserial_init() (1) or require
+// all buffers to be supplied (0, see SOFTSERIAL_DEFINE())
+#ifndef SOFTSERIAL_ENABLE_MALLOC
+#define SOFTSERIAL_ENABLE_MALLOC 1
+#endif
+
+// Log level of the component (ESP_LOG_NONE compiles all logging out)
+#ifndef SOFTSERIAL_LOG_LEVEL
+#define SOFTSERIAL_LOG_LEVEL ESP_LOG_VERBOSE
+#endif
+
+// Collect statistics (1) for softserial_get_stats() or compile them out (0)
+#ifndef SOFTSERIAL_ENABLE_STATS
+#define SOFTSERIAL_ENABLE_STATS 1
+#endif
+
+// Maximum number of units using SOFTSERIAL_USE_TIMER
+#ifndef SOFTSERIAL_MAX_TIMER_UNITS
+#define SOFTSERIAL_MAX_TIMER_UNITS 4
+#endif
+
+// Minimum number of hw_timer ticks per bit (at the highest baud rate)
+#ifndef SOFTSERIAL_OVERSAMPLE
+#define SOFTSERIAL_OVERSAMPLE 3
+#endif
+
+// Maximum hw_timer tick rate in Hz
+#ifndef SOFTSERIAL_MAX_TICK_RATE
+#define SOFTSERIAL_MAX_TICK_RATE 120000
+#endif
+
+// Number of edges to measure for softserial_autobaud() (one 0x55 byte has 10)
+#ifndef SOFTSERIAL_AUTOBAUD_EDGES
+#define SOFTSERIAL_AUTOBAUD_EDGES 10
+#endif
+
+// Number of complete frames, which can be buffered with SOFTSERIAL_USE_FRAMES (power of 2)
+#ifndef SOFTSERIAL_MAX_FRAMES
+#define SOFTSERIAL_MAX_FRAMES 4
+#endif
+
+// Stack size and priority of the task, calling the RX callback (SOFTSERIAL_CALLBACK_TASK)
+#ifndef SOFTSERIAL_RX_TASK_STACK
+#define SOFTSERIAL_RX_TASK_STACK 2048
+#endif
+#ifndef SOFTSERIAL_RX_TASK_PRIORITY
+#define SOFTSERIAL_RX_TASK_PRIORITY (configMAX_PRIORITIES - 1)
+#endif
+
+// Maximum frame size, delivered by the RX task with SOFTSERIAL_USE_FRAMES (allocated on its stack)
+#ifndef SOFTSERIAL_RX_TASK_FRAME
+#define SOFTSERIAL_RX_TASK_FRAME 256
+#endif
+
+// Build the I2S TX engine for SOFTSERIAL_USE_I2S (1), which requires the I2S driver
+#ifndef SOFTSERIAL_ENABLE_I2S
+#define SOFTSERIAL_ENABLE_I2S 0
+#endif
+
+// Number and length (in 32 bit words) of the I2S DMA buffers
+#ifndef SOFTSERIAL_I2S_DMA_BUF_COUNT
+#define SOFTSERIAL_I2S_DMA_BUF_COUNT 4
+#endif
+#ifndef SOFTSERIAL_I2S_DMA_BUF_LEN
+#define SOFTSERIAL_I2S_DMA_BUF_LEN 64
+#endif
+
+// Maximum number of edges in a single frame
+#define SOFTSERIAL_MAX_EDGES 12
+
+/**
+ * A lock-free single-producer/single-consumer ring buffer.
+ * Only the producer writes tail and dropped, only the consumer
+ * writes head and dropped_seen.
+ */
 typedef struct {
-    uint8_t data[SOFTSERIAL_MAX_RX_BUF];
-    uint8_t tail;
-    uint8_t head;
-    uint8_t overrun;
+    uint8_t* data;
+    uint8_t* status;
+    uint16_t mask;
+    uint16_t tail;
+    uint16_t head;
+    uint32_t dropped;
+    uint32_t dropped_seen;
 } softserial_buffer_t;
 
 typedef enum {
     SOFTSERIAL_USE_RX    = 1, // Enable input
     SOFTSERIAL_USE_TX    = 2, // Enable output
     SOFTSERIAL_USE_RS485 = 4, // Enable RS485 support (external MAX485 chip required)
+    SOFTSERIAL_USE_TIMER = 8, // Use hw_timer (FRC1) for RX sampling and buffered TX instead of busy waiting
+    SOFTSERIAL_USE_EDGES = 16, // Decode RX from edge timestamps (overrides SOFTSERIAL_USE_TIMER for RX)
+    SOFTSERIAL_USE_MULTIDROP = 32, // Receive only data addressed to node_address (requires 9 data bits)
+    SOFTSERIAL_USE_RESYNC = 64, // Resynchronize RX sampling on every falling edge within a frame
+    SOFTSERIAL_USE_NO_ECHO = 128, // Ignore RX while sending (e.g. RS485 transceivers looping back TX)
+    SOFTSERIAL_USE_FRAMES = 256, // Receive frames delimited by rx_idle_bits of silence (see softserial_read_frame())
+    SOFTSERIAL_USE_I2S = 512, // Send via I2S DMA instead of the CPU (tx_pin must be GPIO3, see SOFTSERIAL_ENABLE_I2S)
+    SOFTSERIAL_USE_INVERTED = 1024, // Inverted line levels (idle low), no internal pull-up
+    SOFTSERIAL_USE_OPEN_DRAIN = 2048, // Single wire half-duplex: Open drain TX on the RX pin (tx_pin == rx_pin), implies SOFTSERIAL_USE_NO_ECHO
 } softserial_features_t;
 
+typedef enum {
+    SOFTSERIAL_PARITY_NONE = 0,
+    SOFTSERIAL_PARITY_EVEN,
+    SOFTSERIAL_PARITY_ODD,
+} softserial_parity_t;
+
+typedef enum {
+    SOFTSERIAL_STOP_BITS_1 = 0,
+    SOFTSERIAL_STOP_BITS_1_5,
+    SOFTSERIAL_STOP_BITS_2,
+} softserial_stop_bits_t;
+
+/**
+ * Per byte status flags (see rx_status_buffer).
+ */
+typedef enum {
+    SOFTSERIAL_STATUS_BIT8          = 1, // The 9th data bit (9 data bits only)
+    SOFTSERIAL_STATUS_PARITY_ERROR  = 2, // The parity bit was wrong
+    SOFTSERIAL_STATUS_FRAMING_ERROR = 4, // The stop bit was low
+} softserial_status_t;
+
+typedef enum {
+    SOFTSERIAL_TRIGGER_DELIMITER = 1, // Notify, when rx_delimiter has been received
+    SOFTSERIAL_TRIGGER_THRESHOLD = 2, // Notify, when rx_threshold bytes are buffered
+    SOFTSERIAL_TRIGGER_IDLE      = 4, // Notify, when the line is idle for rx_idle_bits (requires SOFTSERIAL_USE_TIMER)
+} softserial_triggers_t;
+
+/**
+ * Checksums, calculated over received data (see softserial_checksum()).
+ */
+typedef enum {
+    SOFTSERIAL_CHECKSUM_NONE = 0,
+    SOFTSERIAL_CHECKSUM_CRC16, // CRC-16/MODBUS, appended low byte first
+    SOFTSERIAL_CHECKSUM_CRC8,  // CRC-8/SMBUS (polynomial 0x07, initial value 0)
+    SOFTSERIAL_CHECKSUM_XOR,   // XOR of all bytes
+    SOFTSERIAL_CHECKSUM_CALLBACK, // checksum_cb, starting with checksum_seed
+} softserial_checksum_t;
+
+/**
+ * Checksum callback for SOFTSERIAL_CHECKSUM_CALLBACK.
+ * Called from the ISR for every received byte, so it must be short and
+ * placed in IRAM (IRAM_ATTR), unless SOFTSERIAL_IRAM is 0.
+ * @param sum The checksum so far.
+ * @param data The received byte.
+ * @return The updated checksum.
+ */
+typedef uint32_t (*softserial_checksum_cb_t)(uint32_t sum, uint8_t data);
+
+/**
+ * Statistics of a unit (see softserial_get_stats()).
+ */
+typedef struct {
+    uint32_t rx_bytes;       // Received bytes (including dropped ones)
+    uint32_t tx_bytes;       // Sent bytes
+    uint32_t dropped;        // Received bytes, dropped because of a full RX buffer
+    uint32_t framing_errors; // Received bytes with a low stop bit
+    uint32_t parity_errors;  // Received bytes with a wrong parity bit
+    uint32_t glitches;       // Rejected start bits
+    uint32_t frame_errors;   // Discarded frames (SOFTSERIAL_USE_FRAMES)
+    uint16_t rx_max_fill;    // Maximum number of bytes in the RX buffer
+    uint32_t isr_count;      // Number of ISR invocations (pin and timer)
+    uint64_t isr_cycles;     // CPU cycles spent in the ISRs
+    uint32_t isr_max_cycles; // CPU cycles of the longest ISR invocation
+} softserial_stats_t;
+
+/**
+ * RX callback for softserial_set_rx_callback().
+ * @param arg The argument passed to softserial_set_rx_callback().
+ * @param data The received data (a complete frame with SOFTSERIAL_USE_FRAMES).
+ *        Only valid during the call.
+ * @param len The length of data.
+ */
+typedef void (*softserial_rx_cb_t)(void* arg, const uint8_t* data, size_t len);
+
+/**
+ * Contexts for calling the RX callback.
+ */
+typedef enum {
+    SOFTSERIAL_CALLBACK_ISR = 0, // In the ISR for every byte, bypassing the RX buffer
+    SOFTSERIAL_CALLBACK_TASK,    // In a dedicated task with all data available
+} softserial_callback_mode_t;
+
 typedef struct {
     /**
      * The desired features of this unit.
      */
-    uint8_t features;
+    uint16_t features;
     /**
-     * The desired baud rate of this unit.
+     * The desired baud rate of this unit (at least 300).
      */
     uint32_t baudrate;
+    /**
+     * The number of data bits (5 .. 9). 0 means 8.
+     */
+    uint8_t data_bits;
+    /**
+     * The parity (see softserial_parity_t).
+     */
+    uint8_t parity;
+    /**
+     * The number of stop bits (see softserial_stop_bits_t).
+     * Only the first stop bit is checked when receiving.
+     */
+    uint8_t stop_bits;
+    /**
+     * The number of samples per received bit (1, 3 or 5). 0 means 1.
+     * More than one sample requires SOFTSERIAL_USE_TIMER without
+     * SOFTSERIAL_USE_EDGES. The samples are taken on consecutive timer
+     * ticks around the center of each bit and the majority decides.
+     * The tick rate is raised to provide at least twice this many ticks
+     * per bit. If SOFTSERIAL_MAX_TICK_RATE does not allow that, the unit
+     * takes a single sample per bit.
+     */
+    uint8_t rx_samples;
+    /**
+     * The address of this node if SOFTSERIAL_USE_MULTIDROP is used.
+     * Bytes with the 9th data bit set are addresses. Only the matching
+     * address byte and the data bytes following it are received,
+     * everything else is dropped in the ISR. Use softserial_read_status()
+     * to detect the address bytes.
+     */
+    uint8_t node_address;
+    /**
+     * An additional address, all nodes listen to if SOFTSERIAL_USE_MULTIDROP
+     * is used. Set this to node_address, if broadcasts are not used.
+     */
+    uint8_t broadcast_address;
     /**
      * The GPIO pin to be used as RX data (input)
      * Possible range GPIO_NUM_0 .. GPIO_NUM_16
@@ -40,6 +256,7 @@ typedef struct {
     /**
      * The GPIO pin to be used as TX data (output)
      * Possible range GPIO_NUM_0 .. GPIO_NUM_16
+     * With SOFTSERIAL_USE_OPEN_DRAIN, this must be the RX pin (GPIO16 is not supported).
      */
     gpio_num_t tx_pin;
     /**
@@ -57,9 +274,74 @@ typedef struct {
      * Optional RTOS event bit to set, if data has been received.
      * If event_group is set AND rx_event is > 0, then
      * xEventGroupSetBitsFromISR() is used in the ISR to
-     * notify any task that data has been received.
+     * notify any task, whenever one of the rx_triggers fires.
      */
     EventBits_t rx_event;
+    /**
+     * The conditions for notifying a task (see softserial_triggers_t).
+     * If 0, SOFTSERIAL_TRIGGER_DELIMITER with a linefeed as delimiter is used.
+     */
+    uint8_t rx_triggers;
+    /**
+     * The delimiter for SOFTSERIAL_TRIGGER_DELIMITER.
+     */
+    uint8_t rx_delimiter;
+    /**
+     * The number of buffered bytes for SOFTSERIAL_TRIGGER_THRESHOLD.
+     */
+    uint16_t rx_threshold;
+    /**
+     * The idle time in bit times for SOFTSERIAL_TRIGGER_IDLE and for the end
+     * of a frame with SOFTSERIAL_USE_FRAMES, counted from the center of the
+     * last stop bit. For example, 35 bit times are 3.5 characters in 8N1 format.
+     */
+    uint16_t rx_idle_bits;
+    /**
+     * The checksum, updated for every received byte (see softserial_checksum_t).
+     * With SOFTSERIAL_USE_FRAMES, it is restarted for every frame and frames
+     * are discarded, unless the checksum over data and appended checksum is 0.
+     */
+    uint8_t checksum;
+    /**
+     * The callback for SOFTSERIAL_CHECKSUM_CALLBACK.
+     */
+    softserial_checksum_cb_t checksum_cb;
+    /**
+     * The initial value for SOFTSERIAL_CHECKSUM_CALLBACK.
+     */
+    uint32_t checksum_seed;
+    /**
+     * Optional storage for received data.
+     * If NULL, SOFTSERIAL_MAX_RX_BUF bytes are allocated by softserial_init()
+     * (required with SOFTSERIAL_ENABLE_MALLOC 0).
+     */
+    uint8_t* rx_buffer;
+    /**
+     * The size of rx_buffer in bytes. Must be a power of 2 (max. 32768).
+     * One byte of the buffer is always kept free.
+     */
+    uint16_t rx_buffer_size;
+    /**
+     * Optional storage for the status of received data (see softserial_status_t).
+     * Must have the same size as the RX buffer (rx_buffer_size or SOFTSERIAL_MAX_RX_BUF).
+     * If NULL, no per byte status is recorded and the 9th data bit is lost.
+     */
+    uint8_t* rx_status_buffer;
+    /**
+     * Optional storage for data to be sent, if SOFTSERIAL_USE_TIMER is used.
+     * If NULL, SOFTSERIAL_MAX_TX_BUF bytes are allocated by softserial_init()
+     * (required with SOFTSERIAL_ENABLE_MALLOC 0).
+     */
+    uint8_t* tx_buffer;
+    /**
+     * The size of tx_buffer in bytes. Must be a power of 2 (max. 32768).
+     */
+    uint16_t tx_buffer_size;
+    /**
+     * Optional storage for the 9th data bit to be sent, if SOFTSERIAL_USE_TIMER
+     * is used with 9 data bits. Must have the same size as the TX buffer.
+     */
+    uint8_t* tx_status_buffer;
     /**
      * Internal use, do not modify directly.
      */
@@ -68,8 +350,244 @@ typedef struct {
      * Internal use, do not modify directly.
      */
     uint16_t bit_time;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint16_t ticks_per_bit;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t rx_state;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint16_t rx_count;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t rx_votes;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t rx_vote_count;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t rx_bit;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint16_t rx_data;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile softserial_buffer_t tx_ring;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t tx_active;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint16_t tx_count;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t tx_bit;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint16_t tx_data;
+    /**
+     * Internal use, do not modify directly.
+     * CPU cycles per bit in fixed point (8 fractional bits).
+     */
+    uint32_t bit_cycles;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint32_t edges[SOFTSERIAL_MAX_EDGES];
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t rx_edges;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile TaskHandle_t rx_waiter;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint16_t rx_wait_count;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t rx_triggered;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint32_t rx_idle;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint8_t frame_bits;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t rx_selected;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint32_t glitches;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint16_t rx_mask;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint16_t tx_mask;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint16_t rs485_mask;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t autobaud;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint32_t autobaud_last;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint32_t autobaud_min;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint32_t autobaud_glitch;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint8_t initialized;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint32_t rx_start;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint32_t frame_last;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint32_t frame_gap;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint16_t frame_tail;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint16_t frame_bytes;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint32_t rx_sum;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t frame_flags;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint16_t frame_len[SOFTSERIAL_MAX_FRAMES];
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t frame_qhead;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t frame_qtail;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint32_t frame_errors;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile softserial_rx_cb_t rx_cb;
+    /**
+     * Internal use, do not modify directly.
+     */
+    void* rx_cb_arg;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint8_t rx_cb_mode;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile TaskHandle_t rx_task;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t rx_task_stop;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint8_t line_invert;
+    /**
+     * Internal use, do not modify directly.
+     */
+    volatile uint8_t rx_sleep;
+    /**
+     * Internal use, do not modify directly.
+     */
+    TickType_t i2s_busy_until;
+    /**
+     * Internal use, do not modify directly.
+     */
+    uint8_t i2s_oversample;
+#if SOFTSERIAL_ENABLE_STATS
+    /**
+     * Internal use, do not modify directly.
+     */
+    softserial_stats_t stats;
+#endif
 } softserial;
 
+/**
+ * Static initializer for a unit.
+ * Further configuration fields may be set before calling softserial_init().
+ * Buffers must have a size, which is a power of 2 (or NULL and 0).
+ */
+#define SOFTSERIAL_INITIALIZER(_features, _baudrate, _rx_pin, _tx_pin, _rx_buffer, _rx_size, _tx_buffer, _tx_size) { \
+    .features = (_features), \
+    .baudrate = (_baudrate), \
+    .rx_pin = (_rx_pin), \
+    .tx_pin = (_tx_pin), \
+    .rx_buffer = (_rx_buffer), \
+    .rx_buffer_size = (_rx_size), \
+    .tx_buffer = (_tx_buffer), \
+    .tx_buffer_size = (_tx_size), \
+}
+
+/**
+ * Define a static unit together with its RX and TX buffers, e.g.
+ *     SOFTSERIAL_DEFINE(port, SOFTSERIAL_USE_RX | SOFTSERIAL_USE_TX, 9600, GPIO_NUM_5, GPIO_NUM_4, 128, 64);
+ *     ...
+ *     softserial_init(&port);
+ * The sizes must be powers of 2.
+ */
+#define SOFTSERIAL_DEFINE(_name, _features, _baudrate, _rx_pin, _tx_pin, _rx_size, _tx_size) \
+    static uint8_t _name##_rx_buffer[_rx_size]; \
+    static uint8_t _name##_tx_buffer[_tx_size]; \
+    static softserial _name = SOFTSERIAL_INITIALIZER(_features, _baudrate, _rx_pin, _tx_pin, \
+            _name##_rx_buffer, sizeof(_name##_rx_buffer), _name##_tx_buffer, sizeof(_name##_tx_buffer))
+
 /**
  * Initialize a softserial unit.
  *
@@ -83,6 +601,31 @@ typedef struct {
  * MUST NOT use gpio_isr_register(). See
  * https://docs.espressif.com/projects/esp8266-rtos-sdk/en/latest/api-reference/peripherals/gpio.html#_CPPv424gpio_install_isr_service
  * for more information.
+ *
+ * If SOFTSERIAL_USE_TIMER is requested, the RX ISR only detects the
+ * start bit and the remaining bits are sampled by the hw_timer (FRC1)
+ * interrupt. Data to be sent is buffered and clocked out by the same
+ * interrupt. A single periodic timer services up to SOFTSERIAL_MAX_TIMER_UNITS
+ * units in both directions simultaneously. It ticks at SOFTSERIAL_OVERSAMPLE
+ * times the least common multiple of their baud rates (at most
+ * SOFTSERIAL_MAX_TICK_RATE) and only while any of them is active.
+ * A start bit is sampled at the tick nearest to its center, so the sample
+ * point is off by up to half a tick. If the timer is idle, it is started
+ * in phase with the start bit. Changing the tick rate by initializing
+ * another unit disturbs frames in progress, so all units should be
+ * initialized before traffic starts. The application MUST NOT use the
+ * hw_timer driver itself.
+ *
+ * If SOFTSERIAL_USE_EDGES is requested, the RX ISR triggers on both edges
+ * and only records a CCOUNT timestamp of each edge. Bytes are reconstructed
+ * from the distances between those edges, so the ISR never waits and
+ * several units can receive concurrently. If combined with SOFTSERIAL_USE_TIMER,
+ * the timer is used for TX only and the unit is full-duplex.
+ *
+ * On errors, everything set up so far (pins, buffers, hw_timer slot) is
+ * released again, so the unit may be reconfigured and initialized again.
+ * Initializing a unit twice without softserial_deinit() in between fails
+ * with ESP_ERR_INVALID_STATE.
  */
 extern esp_err_t softserial_init(softserial* cfg);
 
@@ -90,9 +633,28 @@ extern esp_err_t softserial_init(softserial* cfg);
  * Query availability of received data.
  *
  * @param s The unit to query.
- * @return true, if data is available, false otherwise.
+ * @return The number of received bytes available (0 if none).
+ */
+extern uint16_t softserial_available(softserial* s);
+
+/**
+ * Query the free space in the TX buffer.
+ *
+ * Only units sending with SOFTSERIAL_USE_TIMER have a TX buffer. All other
+ * units send synchronously, so nothing can be queued and this returns 0.
+ *
+ * @param s The unit to query.
+ * @return The number of bytes, which can be queued without blocking.
+ */
+extern uint16_t softserial_tx_free(softserial* s);
+
+/**
+ * Query the size of the TX buffer.
+ *
+ * @param s The unit to query.
+ * @return The maximum number of bytes queued at once (0 without a TX buffer).
  */
-extern uint8_t softserial_available(softserial* s);
+extern uint16_t softserial_tx_capacity(softserial* s);
 
 /**
  * Send a single byte.
@@ -103,6 +665,39 @@ extern uint8_t softserial_available(softserial* s);
  */
 extern esp_err_t softserial_putchar(softserial* s, uint8_t data);
 
+/**
+ * Send a block of bytes.
+ *
+ * The bytes are sent back-to-back, a start bit immediately following the
+ * stop bit of the previous byte. With RS485, TX is enabled for the whole block.
+ * If the unit uses SOFTSERIAL_USE_TIMER, the data is only appended
+ * to the TX buffer and this function returns immediately.
+ * With SOFTSERIAL_USE_I2S, the frames are encoded into the I2S DMA buffers.
+ * This function only blocks (without using the CPU), while all DMA buffers
+ * are queued. A partially filled buffer is sent by a FreeRTOS timer within
+ * a tick, unless more frames fill it first.
+ *
+ * @param s The unit to use for sending.
+ * @param data The data to send.
+ * @param len The number of bytes to send.
+ * @return Number of bytes sent or queued (-1 on error)
+ */
+extern ssize_t softserial_write(softserial* s, const uint8_t* data, size_t len);
+
+/**
+ * Send a block of 9-bit words.
+ *
+ * Like softserial_write() but the 9th data bit is taken from bit 8 of
+ * each word. If the unit uses SOFTSERIAL_USE_TIMER, tx_status_buffer
+ * must be set for the 9th data bit to be sent.
+ *
+ * @param s The unit to use for sending.
+ * @param data The data to send.
+ * @param len The number of words to send.
+ * @return Number of words sent or queued (-1 on error)
+ */
+extern ssize_t softserial_write9(softserial* s, const uint16_t* data, size_t len);
+
 /**
  * Send a string of bytes.
  *
@@ -139,15 +734,281 @@ extern ssize_t softserial_read(softserial* s, uint8_t* buffer, size_t maxlen);
  */
 extern ssize_t softserial_readline(softserial* s, uint8_t* buffer, size_t maxlen);
 
+/**
+ * Receive bytes, blocking until enough data has arrived.
+ *
+ * Waits until len bytes have been received, the delimiter has been received
+ * (if SOFTSERIAL_TRIGGER_DELIMITER is used), any other of the rx_triggers
+ * fired while data is available or the timeout has expired.
+ * In contrast to softserial_read(), the data is not 0-terminated and
+ * the delimiter is included in the data.
+ * The calling task is woken by a direct to task notification from the ISR,
+ * so the notification value of the task must not be used for other purposes.
+ * Only one task at a time may wait on a unit.
+ *
+ * @param s The unit to use for reading.
+ * @param buffer The buffer to fill with the received data.
+ * @param len The maximum number of bytes to read.
+ * @param ticks The maximum time to wait in RTOS ticks (portMAX_DELAY waits forever).
+ * @return Number of bytes read (-1 on overrun)
+ */
+extern ssize_t softserial_read_timeout(softserial* s, uint8_t* buffer, size_t len, TickType_t ticks);
+
+/**
+ * Receive bytes together with their status.
+ *
+ * @param s The unit to use for reading.
+ * @param buffer The buffer to fill with the received data.
+ * @param status The buffer to fill with the SOFTSERIAL_STATUS_xxx flags of each byte
+ *  (all 0, if no rx_status_buffer was supplied).
+ * @param len The maximum number of bytes to read.
+ * @return Number of bytes read (-1 on overrun)
+ */
+extern ssize_t softserial_read_status(softserial* s, uint8_t* buffer, uint8_t* status, size_t len);
+
+/**
+ * Get direct access to received data without copying.
+ *
+ * Returns the contiguous part of the received data, starting at the oldest byte.
+ * If the data wraps around the end of the RX buffer, a second call after
+ * softserial_commit() returns the remainder.
+ *
+ * @param s The unit to use for reading.
+ * @param data Receives a pointer to the first available byte.
+ * @return Number of contiguous bytes available at *data.
+ */
+extern uint16_t softserial_peek(softserial* s, const uint8_t** data);
+
+/**
+ * Release bytes obtained by softserial_peek().
+ *
+ * @param s The unit to use for reading.
+ * @param len Number of bytes, that have been consumed.
+ */
+extern void softserial_commit(softserial* s, uint16_t len);
+
 /**
  * Check and reset overrun flag.
  * @param s The unit to use for reading.
- * @return 1 if a buffer overrun has happened, 0 otherwise.
+ * @return 1 if a buffer overrun has happened since the last call, 0 otherwise.
  *
  * Note, that this gets invoked by softserial_read() and softserial_readline()
  */
 extern uint8_t softserial_overrun(softserial* s);
 
+/**
+ * Get the number of received bytes, that have been dropped because of a full buffer.
+ * @param s The unit to query.
+ * @return The total number of dropped bytes since softserial_init().
+ */
+extern uint32_t softserial_dropped(softserial* s);
+
+/**
+ * Get the number of rejected start bits.
+ * A falling edge is counted as a glitch, if the line is high again in the
+ * center of the start bit.
+ * @param s The unit to query.
+ * @return The total number of glitches since softserial_init().
+ */
+extern uint32_t softserial_glitches(softserial* s);
+
+/**
+ * Receive a complete frame (SOFTSERIAL_USE_FRAMES).
+ *
+ * A frame ends, when the line has been idle for rx_idle_bits. With
+ * SOFTSERIAL_USE_TIMER, the timer detects the silence and the waiting task
+ * is woken once per frame. Otherwise, the silence is noticed by the next
+ * byte or by polling once per RTOS tick while waiting. Frames with parity or
+ * framing errors, a wrong checksum or not fitting into the RX buffer are
+ * discarded, so the RX buffer should hold at least two maximum size frames.
+ * Like softserial_read_timeout(), this uses the notification value of the
+ * calling task. Do not mix with the other read functions.
+ *
+ * @param s The unit to use for reading.
+ * @param buffer The buffer to fill with the frame (including the checksum).
+ * @param len The size of buffer, the rest of a longer frame is discarded.
+ * @param ticks The maximum time to wait in RTOS ticks (portMAX_DELAY waits forever).
+ * @return Number of bytes read, 0 on timeout (-1, if SOFTSERIAL_USE_FRAMES is not used)
+ */
+extern ssize_t softserial_read_frame(softserial* s, uint8_t* buffer, size_t len, TickType_t ticks);
+
+/**
+ * Get the statistics of a unit.
+ * The counters (except dropped, glitches and frame_errors) are only
+ * collected with SOFTSERIAL_ENABLE_STATS. The ISR time of the blocking
+ * RX mode includes busy waiting for the whole frame.
+ * @param s The unit to query.
+ * @param stats Receives the statistics.
+ * @return ESP_OK or ESP_ERR_NOT_SUPPORTED (SOFTSERIAL_ENABLE_STATS is 0)
+ */
+extern esp_err_t softserial_get_stats(softserial* s, softserial_stats_t* stats);
+
+/**
+ * Reset the statistics of a unit, collected with SOFTSERIAL_ENABLE_STATS.
+ * @param s The unit to reset.
+ */
+extern void softserial_reset_stats(softserial* s);
+
+/**
+ * Get the number of received frames, that have been discarded because of
+ * parity, framing or checksum errors.
+ * @param s The unit to query.
+ * @return The total number of corrupted frames since softserial_init().
+ */
+extern uint32_t softserial_frame_errors(softserial* s);
+
+/**
+ * Get the checksum over all bytes received since softserial_init() or
+ * the last call of softserial_checksum_reset().
+ * The checksum is calculated in the ISR, so no second pass over the data is
+ * needed. Bytes dropped because of a full buffer are included.
+ * With SOFTSERIAL_USE_FRAMES, the checksum is restarted for every frame instead.
+ * @param s The unit to query.
+ * @return The current checksum (see softserial_checksum_t).
+ */
+extern uint32_t softserial_checksum(softserial* s);
+
+/**
+ * Restart the checksum of received bytes.
+ * Usually called before sending a request, so the checksum covers the response only.
+ * @param s The unit to reset.
+ */
+extern void softserial_checksum_reset(softserial* s);
+
+/**
+ * Calculate the checksum of a unit over a block of data, e.g. before sending it.
+ * @param s The unit, whose checksum setup to use.
+ * @param data The data.
+ * @param len The length of data.
+ * @return The checksum.
+ */
+extern uint32_t softserial_checksum_calc(softserial* s, const uint8_t* data, size_t len);
+
+/**
+ * Calculate a CRC-16/MODBUS.
+ * @param crc The initial value (0xffff) or the result of a previous call.
+ * @param data The data.
+ * @param len The length of data.
+ * @return The updated CRC.
+ */
+extern uint16_t softserial_crc16(uint16_t crc, const uint8_t* data, size_t len);
+
+/**
+ * Deliver received data to a callback instead of the read functions.
+ *
+ * With SOFTSERIAL_CALLBACK_ISR, the callback is called from the ISR for
+ * every received byte, which is not stored in the RX buffer. It must be
+ * short, must only use ISR safe functions and must be placed in IRAM
+ * (IRAM_ATTR), unless SOFTSERIAL_IRAM is 0. Not supported with SOFTSERIAL_USE_FRAMES.
+ * With SOFTSERIAL_CALLBACK_TASK, a task with SOFTSERIAL_RX_TASK_PRIORITY is
+ * created, which calls the callback with all data in the RX buffer (in up
+ * to two parts, if the data wraps around the end of the buffer) or with
+ * every complete frame with SOFTSERIAL_USE_FRAMES.
+ * Do not use the read functions, while a callback is set.
+ * This may be called from within a SOFTSERIAL_CALLBACK_TASK callback. The
+ * RX task then does not wait for itself, it exits (or continues with the
+ * new task callback), when the current callback returns.
+ *
+ * @param s The unit to use.
+ * @param cb The callback or NULL to stop calling the current one.
+ * @param arg An argument to pass to the callback.
+ * @param mode The context of the callback (see softserial_callback_mode_t).
+ * @return ESP_OK or an ESP error code
+ */
+extern esp_err_t softserial_set_rx_callback(softserial* s, softserial_rx_cb_t cb, void* arg, uint8_t mode);
+
+/**
+ * Change the baud rate of an initialized unit.
+ *
+ * Only the bit timing (and the tick rate of the hw_timer, if used) is
+ * recalculated, the GPIO setup is kept. Data being sent or received
+ * while changing the baud rate is corrupted.
+ *
+ * @param s The unit to change.
+ * @param baudrate The new baud rate.
+ * @return ESP_OK or an ESP error code (the old baud rate is kept on errors)
+ */
+extern esp_err_t softserial_set_baudrate(softserial* s, uint32_t baudrate);
+
+/**
+ * Release a unit, initialized by softserial_init().
+ *
+ * Removes the ISR handler, waits until data queued for the timer engine
+ * has been sent, releases the hw_timer (with the last unit using it),
+ * frees the buffers allocated by softserial_init() and the GPIO pins.
+ * No task may use the unit during or after this call. Received data,
+ * which has not been read yet, is lost.
+ * The GPIO ISR service is left installed, since the application may have
+ * added handlers of its own.
+ *
+ * @param s The unit to release.
+ * @return ESP_OK or ESP_ERR_INVALID_STATE, if the unit is not initialized
+ */
+extern esp_err_t softserial_deinit(softserial* s);
+
+/**
+ * Detect the baud rate of the sender and switch to it.
+ *
+ * Measures the shortest pulse between SOFTSERIAL_AUTOBAUD_EDGES edges on the
+ * RX pin and picks the standard baud rate (300 .. 115200) within 6.25% of it.
+ * The sender must send data with single bit pulses, ideally 0x55 ('U'),
+ * which consists of single bit pulses only and ends exactly on the last
+ * measured edge. Any frame being received, when the measurement starts, is
+ * abandoned and nothing is received during the measurement.
+ * Like softserial_read_timeout(), this uses the notification value of the
+ * calling task and must not be called while another task waits on the unit.
+ *
+ * @param s The unit to use (must use SOFTSERIAL_USE_RX).
+ * @param ticks The maximum time to wait in RTOS ticks (portMAX_DELAY waits forever).
+ * @return ESP_OK, ESP_ERR_TIMEOUT, ESP_ERR_NOT_FOUND (no matching baud rate)
+ *         or an ESP error code of setting the new baud rate.
+ */
+extern esp_err_t softserial_autobaud(softserial* s, TickType_t ticks);
+
+/**
+ * Check, if a unit has sent everything.
+ *
+ * With SOFTSERIAL_USE_TIMER, this is the case when the TX buffer is empty
+ * and the last stop bit (and RS485 TX enable) is complete. Blocking TX is
+ * idle, whenever no write function is running. With SOFTSERIAL_USE_I2S,
+ * the refill timer must have sent the last frames and the idle bits, and
+ * the DMA may still be shifting them out for a short time.
+ *
+ * @param s The unit to check.
+ * @return true, if it is safe to enter light sleep as far as TX is concerned
+ */
+extern bool softserial_tx_idle(softserial* s);
+
+/**
+ * Configure the RX pin as wakeup source for light sleep.
+ *
+ * Call this for every receiving unit right before esp_light_sleep_start().
+ * The level of a start bit wakes the CPU and the pin interrupt is replaced
+ * by the level wakeup, so softserial_wakeup() must be called afterwards.
+ * The first level interrupt masks the pin until softserial_wakeup(). If a
+ * start bit arrives before the CPU actually sleeps, the RX pin therefore
+ * cannot wake it anymore, so keep that window short and combine it with
+ * a timer wakeup.
+ * The byte, whose start bit woke the CPU, is lost. Later bytes may be
+ * corrupt, if they follow without a pause. Therefore the sender should
+ * precede messages by a 0xFF byte (only its start bit is active) and a
+ * pause covering the wakeup time.
+ *
+ * @param s The unit to prepare (GPIO16 cannot be used as wakeup source).
+ * @return ESP_OK, ESP_ERR_INVALID_STATE while sending or receiving, or an ESP error code
+ */
+extern esp_err_t softserial_prepare_sleep(softserial* s);
+
+/**
+ * Rearm RX after light sleep, prepared by softserial_prepare_sleep().
+ *
+ * Removes the wakeup source and reactivates the RX pin interrupt.
+ * Does nothing, if the unit has not been prepared.
+ *
+ * @param s The unit to rearm.
+ */
+extern void softserial_wakeup(softserial* s);
+
 /**
  * LOG tag for EXP_LOGx functions.
  */
@@ -0,0 +1,87 @@
+#include "softserial_modbus.h"
+
+#include <string.h>
+
+#define LOG_LOCAL_LEVEL SOFTSERIAL_LOG_LEVEL
+#include "esp_log.h"
+
+esp_err_t softserial_modbus_init(softserial* s)
+{
+    uint32_t halfbits;
+
+    if (0 == s->data_bits) {
+        s->data_bits = 8;
+    }
+    if ((8 != s->data_bits) || (s->stop_bits > SOFTSERIAL_STOP_BITS_2) || (0 == s->baudrate)) {
+        ESP_LOGE(TAG_SOFTSERIAL, "Invalid Modbus RTU frame format");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s->baudrate > 19200) {
+        // Fixed 1750us
+        s->rx_idle_bits = ((1750 * s->baudrate) + 999999) / 1000000;
+    }
+    else {
+        // Start bit, data bits, parity and stop bit(s) in half bit times
+        halfbits = 2 * (1 + s->data_bits + ((SOFTSERIAL_PARITY_NONE != s->parity) ? 1 : 0)) + s->stop_bits + 2;
+        // 3.5 characters, rounded up
+        s->rx_idle_bits = ((7 * halfbits) + 3) / 4;
+    }
+    // rx_idle_bits is counted from the center of the stop bit
+    s->rx_idle_bits++;
+    if (NULL == s->rx_buffer) {
+        ESP_LOGW(TAG_SOFTSERIAL, "Default RX buffer too small for maximum size Modbus frames");
+    }
+    s->features |= SOFTSERIAL_USE_FRAMES;
+    s->checksum = SOFTSERIAL_CHECKSUM_CRC16;
+    ESP_LOGD(TAG_SOFTSERIAL, "Modbus t3.5 is %d bit times", s->rx_idle_bits);
+    return softserial_init(s);
+}
+
+ssize_t softserial_modbus_read(softserial* s, uint8_t* frame, size_t len, TickType_t ticks)
+{
+    ssize_t ret;
+
+    if (len < SOFTSERIAL_MODBUS_MAX_FRAME) {
+        // A truncated frame would lose its CRC and could not be told apart
+        ESP_LOGE(TAG_SOFTSERIAL, "Modbus frame buffer too small (%d)", (int)len);
+        return -1;
+    }
+    ret = softserial_read_frame(s, frame, len, ticks);
+    if (ret <= 0) {
+        return ret;
+    }
+    // Valid frames have at least one byte plus CRC
+    return ret - 2;
+}
+
+esp_err_t softserial_modbus_write(softserial* s, const uint8_t* frame, size_t len)
+{
+    uint8_t buf[SOFTSERIAL_MODBUS_MAX_FRAME];
+    uint16_t crc;
+    uint16_t capacity;
+
+    if ((0 == len) || (len > (SOFTSERIAL_MODBUS_MAX_FRAME - 2))) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    capacity = softserial_tx_capacity(s);
+    if (capacity) {
+        // The timer engine only queues what fits into the TX buffer,
+        // a partial frame would go out without its CRC.
+        if ((len + 2) > capacity) {
+            ESP_LOGE(TAG_SOFTSERIAL, "Frame does not fit into the TX buffer (%d)", (int)(len + 2));
+            return ESP_ERR_INVALID_SIZE;
+        }
+        while (softserial_tx_free(s) < (len + 2)) {
+            vTaskDelay(1);
+        }
+    }
+    memcpy(buf, frame, len);
+    crc = softserial_crc16(0xffff, frame, len);
+    buf[len] = crc & 0xff;
+    buf[len + 1] = crc >> 8;
+    // Send as a single block to not insert gaps
+    if (softserial_write(s, buf, len + 2) != (ssize_t)(len + 2)) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
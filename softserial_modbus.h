@@ -0,0 +1,59 @@
+#pragma once
+
+#include "softserial.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum size of a Modbus RTU frame (address, PDU and CRC)
+#define SOFTSERIAL_MODBUS_MAX_FRAME 256
+
+/**
+ * Setup and initialize a unit for Modbus RTU.
+ *
+ * Adds SOFTSERIAL_USE_FRAMES with CRC-16 checking to the features and sets
+ * rx_idle_bits to the inter-frame silence t3.5 (3.5 characters, fixed to
+ * 1750us above 19200 baud) before calling softserial_init().
+ * All other fields must be set up as for softserial_init(). The frame
+ * format should be 8E1 or 8N2 as required by Modbus, 8 data bits are mandatory.
+ * Use SOFTSERIAL_USE_TIMER for one wakeup per frame and supply an rx_buffer
+ * of at least 2 * SOFTSERIAL_MODBUS_MAX_FRAME bytes. With SOFTSERIAL_USE_TIMER
+ * and TX, the tx_buffer must be larger than the longest frame sent
+ * (2 * SOFTSERIAL_MODBUS_MAX_FRAME bytes for any frame).
+ *
+ * @param s The unit to setup.
+ * @return ESP_OK or an ESP error code
+ */
+extern esp_err_t softserial_modbus_init(softserial* s);
+
+/**
+ * Receive a Modbus RTU frame with a valid CRC.
+ *
+ * @param s The unit to use for reading.
+ * @param frame The buffer to fill with address and PDU. It must be able to
+ *        hold the CRC of the longest frame as well.
+ * @param len The size of frame (at least SOFTSERIAL_MODBUS_MAX_FRAME, smaller
+ *        buffers are rejected, since a truncated frame would lose its CRC).
+ * @param ticks The maximum time to wait in RTOS ticks (portMAX_DELAY waits forever).
+ * @return Length of the frame without CRC, 0 on timeout or -1 on errors
+ */
+extern ssize_t softserial_modbus_read(softserial* s, uint8_t* frame, size_t len, TickType_t ticks);
+
+/**
+ * Send a Modbus RTU frame, appending its CRC.
+ * The caller is responsible for keeping t3.5 of silence between frames.
+ * With SOFTSERIAL_USE_TIMER, this waits until the TX buffer has room for
+ * the whole frame and queues it at once. Frames, which do not fit into
+ * the TX buffer, are rejected without sending anything.
+ *
+ * @param s The unit to use for sending.
+ * @param frame Address and PDU of the frame.
+ * @param len The length of frame (at most SOFTSERIAL_MODBUS_MAX_FRAME - 2).
+ * @return ESP_OK or an ESP error code
+ */
+extern esp_err_t softserial_modbus_write(softserial* s, const uint8_t* frame, size_t len);
+
+#ifdef __cplusplus
+}
+#endif